@@ -0,0 +1,226 @@
+//
+// bench.h - A small timing harness for the hoist benchmarks.  Each
+//  benchmark is a body that runs a given number of iterations; the harness
+//  grows that number until a run takes long enough to time, repeats it and
+//  keeps the fastest.  Results go to stdout as JSON (or CSV with --csv) so
+//  runs can be compared by a script.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_BENCH_H
+#define HOIST_BENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+// Keeps the optimizer from deleting work whose result is otherwise unused
+
+template <class T>
+inline void KeepAlive (T const & value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile ("" : : "r,m" (value) : "memory");
+#else
+    static void const * volatile sink;
+    sink = &value;
+#endif
+}
+
+
+struct result
+{
+    std::string name;
+    unsigned threads;
+    uint64_t iterations;
+    double nsPerOp;
+};
+
+
+class runner
+{
+public:
+    //
+    //     --csv          CSV instead of JSON
+    //     --filter TEXT  only run benchmarks whose name contains TEXT
+    //     --min-ms N     time each repetition for at least N milliseconds
+    //
+    runner (int argc, char * argv[]) :
+        _csv (false),
+        _minNsecs (100 * 1000 * 1000),
+        _repetitions (3)
+    {
+        for (int index = 1; index < argc; index++) {
+            if (strcmp(argv[index], "--csv") == 0)
+                _csv = true;
+            else if (strcmp(argv[index], "--filter") == 0 and index + 1 < argc)
+                _filter = argv[++index];
+            else if (strcmp(argv[index], "--min-ms") == 0 and index + 1 < argc)
+                _minNsecs = atoll(argv[++index]) * 1000 * 1000;
+            else {
+                fprintf(
+                    stderr,
+                    "usage: %s [--csv] [--filter TEXT] [--min-ms N]\n",
+                    argv[0]
+                );
+                exit(1);
+            }
+        }
+    }
+
+    bool wanted (std::string const & name) const {
+        return _filter.empty() or name.find(_filter) != std::string::npos;
+    }
+
+
+public:
+    // body(iterations) does the operation being measured that many times
+    template <typename Body>
+    void run (std::string const & name, Body body) {
+        contend(name, 1, [&body](unsigned, uint64_t iterations) {
+            body(iterations);
+        });
+    }
+
+    // body(thread, iterations) runs on each of the threads at once, and the
+    // time reported is the wall time divided by the iterations per thread
+    template <typename Body>
+    void contend (std::string const & name, unsigned threads, Body body) {
+        if (not wanted(name))
+            return;
+
+        uint64_t iterations = 1;
+        int64_t elapsed = timeThreads(threads, iterations, body);
+        while (elapsed < _minNsecs and iterations < (UINT64_C(1) << 40)) {
+            // aim a little past the minimum, but never more than 100x
+            double const scale = elapsed <= 0
+                ? 100.0
+                : std::min(100.0, 1.5 * _minNsecs / elapsed);
+            iterations = std::max(
+                iterations + 1, static_cast<uint64_t>(iterations * scale)
+            );
+            elapsed = timeThreads(threads, iterations, body);
+        }
+
+        for (int repetition = 1; repetition < _repetitions; repetition++)
+            elapsed = std::min(elapsed, timeThreads(threads, iterations, body));
+
+        record(name, threads, iterations, elapsed);
+    }
+
+    // For operations that can only be timed as one batch of a set size,
+    // such as filling a container; nsecs is the time for all of them
+    void record (
+        std::string const & name,
+        unsigned threads,
+        uint64_t iterations,
+        int64_t nsecs
+    ) {
+        _results.push_back(result {
+            name,
+            threads,
+            iterations,
+            static_cast<double>(nsecs) / static_cast<double>(iterations)
+        });
+    }
+
+    void report () const {
+        if (_csv) {
+            printf("name,threads,iterations,ns_per_op\n");
+            for (result const & r : _results) {
+                printf(
+                    "\"%s\",%u,%llu,%.3f\n",
+                    r.name.c_str(),
+                    r.threads,
+                    static_cast<unsigned long long>(r.iterations),
+                    r.nsPerOp
+                );
+            }
+            return;
+        }
+
+        printf("{\n    \"benchmarks\": [");
+        for (size_t index = 0; index < _results.size(); index++) {
+            result const & r = _results[index];
+            printf(
+                "%s\n        {\"name\": \"%s\", \"threads\": %u,"
+                " \"iterations\": %llu, \"ns_per_op\": %.3f}",
+                index == 0 ? "" : ",",
+                r.name.c_str(),
+                r.threads,
+                static_cast<unsigned long long>(r.iterations),
+                r.nsPerOp
+            );
+        }
+        printf("\n    ]\n}\n");
+    }
+
+
+public:
+    static int64_t nsecsSince (std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+    }
+
+private:
+    // The threads are all started and wait at a gate, so thread creation
+    // isn't part of what is timed
+    template <typename Body>
+    static int64_t timeThreads (
+        unsigned threads,
+        uint64_t iterations,
+        Body & body
+    ) {
+        if (threads == 1) {
+            auto const start = std::chrono::steady_clock::now();
+            body(0, iterations);
+            return nsecsSince(start);
+        }
+
+        std::atomic<unsigned> ready (0);
+        std::atomic<bool> go (false);
+        std::vector<std::thread> workers;
+        for (unsigned thread = 0; thread < threads; thread++) {
+            workers.emplace_back([&, thread]() {
+                ready.fetch_add(1);
+                while (not go.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                body(thread, iterations);
+            });
+        }
+        while (ready.load() != threads)
+            std::this_thread::yield();
+
+        auto const start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (std::thread & worker : workers)
+            worker.join();
+        return nsecsSince(start);
+    }
+
+private:
+    bool _csv;
+    std::string _filter;
+    int64_t _minNsecs;
+    int _repetitions;
+    std::vector<result> _results;
+};
+
+} // end namespace bench
+
+#endif
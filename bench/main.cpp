@@ -0,0 +1,469 @@
+//
+// main.cpp - Microbenchmarks for the costs hoist adds to code that uses it:
+//  making codeplaces, checking hopes that hold, assigning tracked values,
+//  registering instances with the managers, and a chronicle that is off.
+//  Where it helps to see the overhead, the plain C++ operation is timed
+//  alongside.  The managers are also timed with several threads at once.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "bench.h"
+
+#include "hoist/codeplace.h"
+#include "hoist/hopefully.h"
+#include "hoist/tracked.h"
+#include "hoist/atomic_tracked.h"
+#include "hoist/listed.h"
+#include "hoist/mapped.h"
+#include "hoist/stacked.h"
+#include "hoist/chronicle.h"
+#include "hoist/cast_hopefully.h"
+
+#include <functional>
+#include <memory>
+
+using namespace hoist;
+
+namespace {
+
+unsigned const contentionThreads[] = {2, 4, 8};
+
+
+void BenchCodeplaces (bench::runner & runner) {
+    runner.run("HERE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            codeplace cp = HERE;
+            bench::KeepAlive(cp);
+        }
+    });
+
+    runner.run("PLACE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            codeplace cp = PLACE("eYeT9l1bRGyGSwp4E2ewTw");
+            bench::KeepAlive(cp);
+        }
+    });
+
+    codeplace const first = HERE;
+    codeplace const second = HERE;
+
+    runner.run("codeplace copy", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            codeplace copy (first);
+            bench::KeepAlive(copy);
+        }
+    });
+
+    runner.run("codeplace hash", [&](uint64_t iterations) {
+        std::hash<codeplace> hasher;
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(first);
+            bench::KeepAlive(hasher(first));
+        }
+    });
+
+    runner.run("codeplace compare", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(first);
+            bench::KeepAlive(first == second);
+        }
+    });
+
+    for (unsigned threads : contentionThreads) {
+        runner.contend("HERE", threads, [](unsigned, uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; i++) {
+                codeplace cp = HERE;
+                bench::KeepAlive(cp);
+            }
+        });
+
+        runner.contend(
+            "codeplace copy",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++) {
+                    codeplace copy (first);
+                    bench::KeepAlive(copy);
+                }
+            }
+        );
+    }
+}
+
+
+void BenchHopefully (bench::runner & runner) {
+    runner.run("baseline: if", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            if (i == UINT64_MAX)
+                abort();
+            bench::KeepAlive(i);
+        }
+    });
+
+    runner.run("hopefully HERE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(hopefully(i != UINT64_MAX, HERE));
+    });
+
+    runner.run("hopefully message HERE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(
+                hopefully(i != UINT64_MAX, "never fails", HERE)
+            );
+        }
+    });
+
+    runner.run("hopefully lazy message HERE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(hopefully(
+                i != UINT64_MAX,
+                [&]() { return QString::number(qulonglong (i)); },
+                HERE
+            ));
+        }
+    });
+
+    runner.run("hopefully format HERE", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(
+                hopefully(i != UINT64_MAX, "at %1", HERE, i)
+            );
+        }
+    });
+
+    codesite const site (HERE);
+    runner.run("hopefully codesite", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(hopefully(i != UINT64_MAX, site));
+    });
+
+    for (unsigned threads : contentionThreads) {
+        runner.contend(
+            "hopefully HERE",
+            threads,
+            [](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                    bench::KeepAlive(hopefully(i != UINT64_MAX, HERE));
+            }
+        );
+    }
+}
+
+
+void BenchTracked (bench::runner & runner) {
+    runner.run("baseline: int assign", [](uint64_t iterations) {
+        int value = 0;
+        for (uint64_t i = 0; i < iterations; i++) {
+            value = static_cast<int>(i);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("tracked assign", [](uint64_t iterations) {
+        tracked<int> value (0, HERE);
+        for (uint64_t i = 0; i < iterations; i++) {
+            value.assign(static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("tracked<codesite> assign", [](uint64_t iterations) {
+        tracked<int, codesite> value (0, HERE);
+        for (uint64_t i = 0; i < iterations; i++) {
+            value.assign(static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("tracked<history 8> assign", [](uint64_t iterations) {
+        tracked<int, codeplace, 8> value (0, HERE);
+        for (uint64_t i = 0; i < iterations; i++) {
+            value.assign(static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("tracked assign, watch on another", [](uint64_t iterations) {
+        tracked<int> watched (0, HERE);
+        tracked_watch watch = watched.watchFor(
+            -1, [](int const &, codeplace const &) {}
+        );
+        tracked<int> value (0, HERE);
+        for (uint64_t i = 0; i < iterations; i++) {
+            value.assign(static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("atomic_tracked assign", [](uint64_t iterations) {
+        atomic_tracked<int> value (0, HERE);
+        for (uint64_t i = 0; i < iterations; i++) {
+            value.assign(static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    runner.run("tracked construct and destroy", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            tracked<int> value (static_cast<int>(i), HERE);
+            bench::KeepAlive(value);
+        }
+    });
+
+    for (unsigned threads : contentionThreads) {
+        atomic_tracked<int> shared (0, HERE);
+        runner.contend(
+            "atomic_tracked assign",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                    shared.assign(static_cast<int>(i), HERE);
+            }
+        );
+    }
+}
+
+
+void BenchChronicle (bench::runner & runner) {
+    tracked<bool> enabled (false, HERE);
+    tracked<bool, codesite> enabledSite (false, HERE);
+    QString const message ("message");
+
+    runner.run("chronicle off", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(chronicle(enabled, message, HERE));
+    });
+
+    runner.run("chronicle off, lazy", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(chronicle(
+                enabled, [&]() { return QString::number(qulonglong (i)); }, HERE
+            ));
+        }
+    });
+
+    runner.run("chronicle off, format", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(chronicle(enabled, "at %1", HERE, i));
+    });
+
+    runner.run("chronicle<codesite> off", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(chronicle(enabledSite, message, HERE));
+    });
+}
+
+
+struct base_class
+{
+    virtual ~base_class () {}
+};
+
+struct derived_class : base_class
+{
+};
+
+
+void BenchCasts (bench::runner & runner) {
+    runner.run("baseline: static_cast<short>", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++)
+            bench::KeepAlive(static_cast<short>(i & 0x7FFF));
+    });
+
+    runner.run("cast_hopefully<short> from int", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(
+                cast_hopefully<short>(static_cast<int>(i & 0x7FFF), HERE)
+            );
+        }
+    });
+
+    runner.run("cast_hopefully<int> from unsigned", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(cast_hopefully<int>(
+                static_cast<unsigned>(i & 0xFFFF), HERE
+            ));
+        }
+    });
+
+    derived_class derived;
+    base_class * base = &derived;
+
+    runner.run("baseline: dynamic_cast", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(base);
+            bench::KeepAlive(dynamic_cast<derived_class *>(base));
+        }
+    });
+
+    runner.run("cast_hopefully pointer", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; i++) {
+            bench::KeepAlive(base);
+            bench::KeepAlive(cast_hopefully<derived_class *>(base, HERE));
+        }
+    });
+}
+
+
+// Keys made from the thread and iteration, so no two threads collide
+
+uint64_t KeyFor (unsigned thread, uint64_t i) {
+    return (static_cast<uint64_t>(thread) << 48) | i;
+}
+
+
+void BenchManagers (bench::runner & runner) {
+    std::vector<unsigned> threadCounts (1, 1);
+    threadCounts.insert(
+        threadCounts.end(),
+        std::begin(contentionThreads),
+        std::end(contentionThreads)
+    );
+
+    for (unsigned threads : threadCounts) {
+        listed<int>::manager listedManager;
+        runner.contend(
+            "listed construct and destroy",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++) {
+                    listed<int> item (
+                        static_cast<int>(i), listedManager, HERE
+                    );
+                    bench::KeepAlive(item);
+                }
+            }
+        );
+
+        mapped<uint64_t, int>::manager mappedManager;
+        runner.contend(
+            "mapped construct and destroy",
+            threads,
+            [&](unsigned thread, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++) {
+                    mapped<uint64_t, int> item (
+                        KeyFor(thread, i),
+                        static_cast<int>(i),
+                        mappedManager,
+                        HERE
+                    );
+                    bench::KeepAlive(item);
+                }
+            }
+        );
+
+        stacked<int>::manager stackedManager;
+        runner.contend(
+            "stacked construct and destroy",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++) {
+                    stacked<int> item (
+                        static_cast<int>(i), stackedManager, HERE
+                    );
+                    bench::KeepAlive(item);
+                }
+            }
+        );
+    }
+
+    // Readers of a registry of a thousand items that isn't changing
+
+    for (unsigned threads : threadCounts) {
+        listed<int>::manager listedManager;
+        mapped<uint64_t, int>::manager mappedManager;
+        std::vector<std::unique_ptr<listed<int>>> listedItems;
+        std::vector<std::unique_ptr<mapped<uint64_t, int>>> mappedItems;
+        for (int index = 0; index < 1000; index++) {
+            listedItems.emplace_back(
+                new listed<int> (index, listedManager, HERE)
+            );
+            mappedItems.emplace_back(new mapped<uint64_t, int> (
+                static_cast<uint64_t>(index), index, mappedManager, HERE
+            ));
+        }
+
+        runner.contend(
+            "listed getSnapshot of 1000",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++)
+                    bench::KeepAlive(listedManager.getSnapshot());
+            }
+        );
+
+        runner.contend(
+            "mapped lookupValue in 1000",
+            threads,
+            [&](unsigned, uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; i++) {
+                    bench::KeepAlive(
+                        mappedManager.lookupValue(i % 1000, -1)
+                    );
+                }
+            }
+        );
+    }
+}
+
+// Fills a listed manager with count instances, then destroys them in an
+// order scattered over the whole list.  Both phases are timed as a batch,
+// which is where registration that is not constant time shows up.
+
+void BenchListedRegistration (bench::runner & runner, size_t count) {
+    std::string const suffix = " " + std::to_string(count);
+    std::string const constructName = "listed register of" + suffix;
+    std::string const destroyName = "listed unregister of" + suffix;
+    if (not runner.wanted(constructName) and not runner.wanted(destroyName))
+        return;
+
+    listed<int>::manager manager;
+    std::vector<std::unique_ptr<listed<int>>> items;
+    items.reserve(count);
+
+    auto const constructStart = std::chrono::steady_clock::now();
+    for (size_t index = 0; index < count; index++) {
+        items.emplace_back(
+            new listed<int> (static_cast<int>(index), manager, HERE)
+        );
+    }
+    int64_t const constructNsecs = bench::runner::nsecsSince(constructStart);
+
+    // 7919 is a prime that divides none of the counts, so stepping by it
+    // visits every index once
+    auto const destroyStart = std::chrono::steady_clock::now();
+    for (size_t index = 0; index < count; index++)
+        items[(index * 7919) % count].reset();
+    int64_t const destroyNsecs = bench::runner::nsecsSince(destroyStart);
+
+    if (runner.wanted(constructName))
+        runner.record(constructName, 1, count, constructNsecs);
+    if (runner.wanted(destroyName))
+        runner.record(destroyName, 1, count, destroyNsecs);
+}
+
+} // end anonymous namespace
+
+
+int main (int argc, char * argv[]) {
+    bench::runner runner (argc, argv);
+
+    BenchCodeplaces(runner);
+    BenchHopefully(runner);
+    BenchTracked(runner);
+    BenchChronicle(runner);
+    BenchCasts(runner);
+    BenchManagers(runner);
+
+    for (size_t count : {10000, 100000, 1000000})
+        BenchListedRegistration(runner, count);
+
+    runner.report();
+    return 0;
+}
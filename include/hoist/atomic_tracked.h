@@ -0,0 +1,408 @@
+//
+// atomic_tracked.h - A tracked value that can be read and assigned from
+//  any number of threads.  The value and the codesite of the assignment
+//  that produced it are published together, so a reader never sees a
+//  value paired with some other assignment's location.  T must be
+//  trivially copyable, comparable with == and have a QTextStream
+//  operator<< (or be an enum).
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_ATOMIC_TRACKED_H
+#define HOIST_ATOMIC_TRACKED_H
+
+#include "codeplace.h"
+#include "hopefully.h"
+#include "tracked.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace hoist {
+
+namespace detail {
+
+// What an atomic_tracked holds: a value and the site that assigned it
+
+template <class T>
+struct atomic_tracked_pair
+{
+    T value;
+    codesite where;
+};
+
+
+// When the pair fits in 64 bits (T of 4 bytes or less) it is kept in a
+// single std::atomic, and every operation is one instruction.
+
+template <class T, bool Packed = sizeof(atomic_tracked_pair<T>) <= 8>
+class atomic_tracked_storage
+{
+public:
+    typedef atomic_tracked_pair<T> pair;
+
+    explicit atomic_tracked_storage (pair const & initial) :
+        _pair (initial)
+    {
+    }
+
+    pair load () const {
+        return _pair.load(std::memory_order_acquire);
+    }
+
+    void store (pair const & desired) {
+        _pair.store(desired, std::memory_order_release);
+    }
+
+    pair exchange (pair const & desired) {
+        return _pair.exchange(desired, std::memory_order_acq_rel);
+    }
+
+    // Writes desired only if the value is expectedValue; either way, seen
+    // gets what was there.  The compare is on the value alone (not on the
+    // site, nor on padding bytes) so it loops on the compare-and-swap.
+    bool transition (
+        T const & expectedValue,
+        pair const & desired,
+        pair & seen
+    ) {
+        seen = _pair.load(std::memory_order_acquire);
+        while (seen.value == expectedValue) {
+            if (
+                _pair.compare_exchange_weak(
+                    seen,
+                    desired,
+                    std::memory_order_acq_rel,
+                    std::memory_order_acquire
+                )
+            ) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::atomic<pair> _pair;
+};
+
+
+// Anything bigger goes behind a sequence number, which is odd while a
+// writer is in the middle of an update.  Readers copy the words and try
+// again if the number moved, so they never wait on a lock; writers take
+// turns by moving the number to odd with a compare-and-swap.  The words
+// are atomics themselves so that a reader racing a writer is well defined.
+
+template <class T>
+class atomic_tracked_storage<T, false>
+{
+public:
+    typedef atomic_tracked_pair<T> pair;
+
+    explicit atomic_tracked_storage (pair const & initial) :
+        _sequence (0)
+    {
+        write(initial);
+    }
+
+    pair load () const {
+        uint64_t words[WordCount];
+        for (;;) {
+            uint32_t const before = _sequence.load(std::memory_order_acquire);
+            if (before % 2 == 0) {
+                for (size_t index = 0; index < WordCount; index++) {
+                    words[index]
+                        = _words[index].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (_sequence.load(std::memory_order_relaxed) == before)
+                    break;
+            }
+            std::this_thread::yield();
+        }
+
+        pair result;
+        memcpy(&result, words, sizeof(pair));
+        return result;
+    }
+
+    void store (pair const & desired) {
+        uint32_t const sequence = lock();
+        write(desired);
+        unlock(sequence);
+    }
+
+    pair exchange (pair const & desired) {
+        uint32_t const sequence = lock();
+        pair const previous = read();
+        write(desired);
+        unlock(sequence);
+        return previous;
+    }
+
+    bool transition (
+        T const & expectedValue,
+        pair const & desired,
+        pair & seen
+    ) {
+        uint32_t const sequence = lock();
+        seen = read();
+        bool const result = seen.value == expectedValue;
+        if (result)
+            write(desired);
+        unlock(sequence);
+        return result;
+    }
+
+private:
+    uint32_t lock () {
+        uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+        while (
+            sequence % 2 != 0
+            or not _sequence.compare_exchange_weak(
+                sequence,
+                sequence + 1,
+                std::memory_order_acquire,
+                std::memory_order_relaxed
+            )
+        ) {
+            std::this_thread::yield();
+            sequence = _sequence.load(std::memory_order_relaxed);
+        }
+        // keeps the writes to the words from moving above the odd number
+        std::atomic_thread_fence(std::memory_order_release);
+        return sequence;
+    }
+
+    void unlock (uint32_t const sequence) {
+        _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    // only while holding the lock
+    pair read () const {
+        uint64_t words[WordCount];
+        for (size_t index = 0; index < WordCount; index++)
+            words[index] = _words[index].load(std::memory_order_relaxed);
+
+        pair result;
+        memcpy(&result, words, sizeof(pair));
+        return result;
+    }
+
+    void write (pair const & desired) {
+        uint64_t words[WordCount] = {};
+        memcpy(words, &desired, sizeof(pair));
+        for (size_t index = 0; index < WordCount; index++)
+            _words[index].store(words[index], std::memory_order_relaxed);
+    }
+
+private:
+    static size_t const WordCount = (sizeof(pair) + 7) / 8;
+
+    std::atomic<uint32_t> _sequence;
+    std::atomic<uint64_t> _words[WordCount];
+};
+
+} // end namespace detail
+
+
+
+//
+// The locations are always kept as codesites, which is what lets a pair
+// fit in one atomic.  Reads never block.  Assignments of a T of 4 bytes or
+// less are a single atomic store or exchange; bigger ones wait only on
+// other writers of the same object.
+//
+// The checks are made against one consistent snapshot, and a failure
+// reports the site that assigned the value that was seen.  As with the
+// std::atomic forms of hopefullyAlter and hopefullyTransition in
+// hopefully.h, a transition here is one compare-and-swap: losing a race
+// leaves the other thread's value in place, and the report says what it
+// was.
+//
+
+template <class T>
+class atomic_tracked final
+{
+    static_assert(
+        std::is_trivially_copyable<T>::value,
+        "atomic_tracked needs a trivially copyable type"
+    );
+
+    Q_DISABLE_COPY(atomic_tracked)
+
+public:
+    typedef detail::atomic_tracked_pair<T> snapshot_type;
+
+public:
+    atomic_tracked (T const & value, codeplace const & cp) :
+        _constructSite (siteFor(cp)),
+        _storage (snapshot_type {value, _constructSite})
+    {
+    }
+
+
+public:
+    // The value and the site that assigned it, read together
+    snapshot_type snapshot () const {
+        return _storage.load();
+    }
+
+    T get () const {
+        return _storage.load().value;
+    }
+
+    operator T () const {
+        return get();
+    }
+
+    codeplace whereConstructed () const {
+        return placeFor(_constructSite);
+    }
+
+    codeplace whereLastAssigned () const {
+        return placeFor(_storage.load().where);
+    }
+
+
+public:
+    bool hopefullyEqualTo (T const & value, codeplace const & cp) const {
+        snapshot_type const seen = _storage.load();
+        if (Q_LIKELY(seen.value == value))
+            return true;
+        return checkFailed("Expected value to be ", value, seen, cp);
+    }
+
+    bool hopefullyNotEqualTo (T const & value, codeplace const & cp) const {
+        snapshot_type const seen = _storage.load();
+        if (Q_LIKELY(not (seen.value == value)))
+            return true;
+        return checkFailed("Didn't expect value to be ", value, seen, cp);
+    }
+
+
+//
+// Operations for setting the value
+//
+public:
+    void assign (T const & newValue, codeplace const & cp) {
+        _storage.store(snapshot_type {newValue, siteFor(cp)});
+    }
+
+    // Another thread may assign between the compare and the store; use
+    // hopefullyTransition when that matters
+    void guarantee (T const & newValue, codeplace const & cp) {
+        if (not (_storage.load().value == newValue))
+            assign(newValue, cp);
+    }
+
+    bool hopefullyAlter (T const & newValue, codeplace const & cp) {
+        snapshot_type const previous = _storage.exchange(
+            snapshot_type {newValue, siteFor(cp)}
+        );
+        if (Q_LIKELY(not (previous.value == newValue)))
+            return true;
+        return checkFailed(
+            "Expected value to change but it was already ",
+            newValue,
+            previous,
+            cp
+        );
+    }
+
+    bool hopefullyTransition (
+        T const & oldValue,
+        T const & newValue,
+        codeplace const & cp
+    ) {
+        snapshot_type seen;
+        if (
+            Q_LIKELY(_storage.transition(
+                oldValue, snapshot_type {newValue, siteFor(cp)}, seen
+            ))
+        ) {
+            return true;
+        }
+        return transitionFailed(oldValue, newValue, seen, cp);
+    }
+
+
+private:
+    static codesite siteFor (codeplace const & cp) {
+        return HOIST_TRACKING ? codesite (cp) : codesite ();
+    }
+
+    static codeplace placeFor (codesite const & site) {
+        return site.isNull() ? codeplace () : codeplace (site);
+    }
+
+    static void writeWhere (QTextStream & ts, snapshot_type const & seen) {
+        if (HOIST_TRACKING) {
+            ts << endl << "It was assigned at "
+                << placeFor(seen.where);
+        }
+    }
+
+    HOIST_COLD bool checkFailed (
+        char const * expectation,
+        T const & value,
+        snapshot_type const & seen,
+        codeplace const & cp
+    )
+        const
+    {
+        auto makeMessage = [&]() {
+            QString message;
+            QTextStream ts (&message);
+            ts << expectation;
+            detail::StreamValue(ts, value);
+            if (not (seen.value == value)) {
+                ts << " and it was ";
+                detail::StreamValue(ts, seen.value);
+            }
+            writeWhere(ts, seen);
+            ts.flush();
+            return message;
+        };
+        return hopefullyNotReached(hope_message (makeMessage), cp);
+    }
+
+    HOIST_COLD bool transitionFailed (
+        T const & oldValue,
+        T const & newValue,
+        snapshot_type const & seen,
+        codeplace const & cp
+    )
+        const
+    {
+        auto makeMessage = [&]() {
+            QString message;
+            QTextStream ts (&message);
+            ts << "Expected transition from ";
+            detail::StreamValue(ts, oldValue);
+            ts << " to ";
+            detail::StreamValue(ts, newValue);
+            ts << " but the value was ";
+            detail::StreamValue(ts, seen.value);
+            writeWhere(ts, seen);
+            ts.flush();
+            return message;
+        };
+        return hopefullyNotReached(hope_message (makeMessage), cp);
+    }
+
+private:
+    codesite const _constructSite;
+    detail::atomic_tracked_storage<T> _storage;
+};
+
+} // end namespace hoist
+
+#endif
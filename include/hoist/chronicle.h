@@ -17,6 +17,7 @@
 #define HOIST_CHRONICLE_H
 
 #include <functional>
+#include <type_traits>
 
 #include "codeplace.h"
 #include "tracked.h"
@@ -37,6 +38,51 @@ bool chronicle (
     codeplace const & cp
 );
 
+bool chronicle (
+    tracked<bool, codesite> const & enabled,
+    QString const & message,
+    codeplace const & cp
+);
+
+bool chronicle (
+    tracked<bool, codesite> const & enabled,
+    chronicle_function function,
+    codeplace const & cp
+);
+
+
+// Lazy forms, which only make the message when chronicling is enabled; see
+// the matching hopefully() overloads
+
+template <
+    class Place,
+    typename F,
+    typename = typename std::enable_if<detail::is_message_maker<F>::value>::type
+>
+inline bool chronicle (
+    tracked<bool, Place> const & enabled,
+    F const & makeMessage,
+    codeplace const & cp
+) {
+    if (Q_UNLIKELY(enabled.get()))
+        chronicle(enabled, QString (makeMessage()), cp);
+    return enabled.get();
+}
+
+
+template <class Place, typename Arg, typename... Args>
+inline bool chronicle (
+    tracked<bool, Place> const & enabled,
+    char const * format,
+    codeplace const & cp,
+    Arg const & arg,
+    Args const &... args
+) {
+    if (Q_UNLIKELY(enabled.get()))
+        chronicle(enabled, MessageFromFormat(format, arg, args...), cp);
+    return enabled.get();
+}
+
 } // end namespace hoist
 
 #endif
@@ -20,6 +20,7 @@
 // for what should be obvious reasons, codeplace cannot use "hopefully"
 // as its assertion service (hopefully is implemented in terms of codeplace!)
 #include <cassert>
+#include <atomic>
 
 #include <QUuid>
 #include <QByteArray>
@@ -27,6 +28,8 @@
 #include <QCryptographicHash>
 #include <QCoreApplication>
 
+#include "uuid128.h"
+
 namespace hoist {
 
 QByteArray Base64StringFromUuid (QUuid const & uuid);
@@ -35,10 +38,67 @@ QUuid UuidFromBase64String (QByteArray const & str);
 
 QUuid UuidFrom128Bits (QByteArray const & bytes);
 
+QUuid UuidFrom128Bits (uuid128 const & bits);
+
+uuid128 Uuid128FromUuid (QUuid const & uuid);
+
+
+class codeplace;
+
+//
+// A codesite is a 32-bit handle on a codeplace in the registry (see
+// codeplace::remember).  Unlike codeplace it is trivially copyable and
+// destructible, so objects holding a lot of small tracked values can keep
+// codesites instead of codeplaces and stay cache-friendly.  Turning one
+// back into a codeplace is an index into the registry's table of sites.
+//
+// Two codesites are equal if they name the same registered codeplace.  The
+// default-constructed codesite corresponds to a null codeplace.
+//
+
+class codesite final
+{
+template <class> friend struct ::std::hash;
+friend class codeplace;
+
+public:
+    constexpr codesite () :
+        _index (0)
+    {
+    }
+
+    // Free if the codeplace came from HERE or PLACE, otherwise this costs
+    // a registry lookup (and an insertion if it has never been seen)
+    explicit codesite (codeplace const & cp);
+
+    operator codeplace () const;
+
+    constexpr bool operator== (codesite const & rhs) const {
+        return _index == rhs._index;
+    }
+
+    constexpr bool operator!= (codesite const & rhs) const {
+        return _index != rhs._index;
+    }
+
+    constexpr bool isNull () const {
+        return _index == 0;
+    }
+
+private:
+    explicit constexpr codesite (uint32_t const index) :
+        _index (index)
+    {
+    }
+
+    uint32_t _index;
+};
+
 
 class codeplace final
 {
 template <class> friend struct ::std::hash;
+friend class codesite;
 
 public: // switch to private and declare operators as friends...
     enum class Options {
@@ -51,12 +111,23 @@ public: // switch to private and declare operators as friends...
 
         // codeplace is optimized to avoid making a lot of QStrings out of
         // immutable string literals that you're already paying for in the
-        // compiler's constant pool. The only time it actually uses QStrings
-        // is if you pass in a UUID or filename string that needs to have its
-        // own memory management.
+        // compiler's constant pool. The only time it actually uses a QString
+        // is if you pass in a filename string that needs to have its own
+        // memory management.  (The uuid is always decoded or hashed into
+        // 128 bits at construction, so no uuid string is ever kept.)
+        //
+        // That QString is held in an immutable reference-counted block, so
+        // copying such a codeplace bumps a count instead of allocating.
+        // THERE and YONDER don't use it at all: they intern their filename
+        // into a permanent table and keep a char const * like __FILE__.
 
         FilenameIsQString = 1 << 2,
-        UuidIsQString = 1 << 3
+
+        // YONDER makes a new uuid out of each distinct message, so the
+        // registry would grow without bound if it kept them.  These are
+        // never remembered, and their codesite is null.
+
+        Transient = 1 << 3
 
         // Note that as a general rule... if you enable string pooling a.k.a.
         // string interning you can save memory, e.g. when 100 asserts in the
@@ -79,15 +150,37 @@ public:
     // created problems with shutdown and initialization and the
     // usage pattern of global char const * instead of QString emerged
     // as dominant, so the manager has been removed for now.
+    //
+    // The lookup has come back as the registry below, which is made only
+    // of zero-initialized static memory and is never destroyed, so it may
+    // be used during static initialization and shutdown.
 
     static codeplace makeHere (char const * filename, long const & line);
 
     static codeplace makeHere (QString const & filename, long const & line);
 
+    // The macros pass in the codesite they got by remembering the site
+    // once, so the codeplaces they produce convert to a codesite for free
+
+    static codeplace makeHere (
+        char const * filename,
+        long const & line,
+        uuid128 const & hashedUuid,
+        codesite const & site = codesite ()
+    );
+
     static codeplace makePlace (
         char const * filename,
         long const & line,
-        char const * uuidString
+        char const * uuidString,
+        codesite const & site = codesite ()
+    );
+
+    static codeplace makePlace (
+        char const * filename,
+        long const & line,
+        uuid128 const & uuid,
+        codesite const & site = codesite ()
     );
 
     static codeplace makePlace (
@@ -108,6 +201,49 @@ public:
     );
 
 
+public:
+    // Registry of every codeplace that has been materialized, so that a
+    // uuid from a crash report or telemetry can be resolved in-process.
+    // HERE and PLACE remember their codeplace the first time each site
+    // runs, and THERE (as well as the QString makers) remember each one
+    // they make.  A site is the uuid together with the file and line, since
+    // THERE shares the uuid of the codeplace it was given; lookup() by uuid
+    // alone gives the first site registered for it.  YONDER codeplaces are
+    // not remembered (see Options::Transient).  It is append-only; lookups
+    // are wait-free and usually cost one cache miss.  Remembering is
+    // lock-free, save that two threads remembering the same uuid at the
+    // same moment may wait on each other for the few stores it takes to
+    // publish it.
+    //
+    // remember() gives back the codesite of the codeplace, which the macros
+    // keep in a function-local static.  lookup() gives back a null codeplace
+    // if the uuid has never been seen.
+
+    static codesite remember (codeplace const & cp);
+
+    static codeplace lookup (uuid128 const & uuid);
+
+    static codeplace lookup (QUuid const & uuid);
+
+    static codeplace lookup (codesite const & site);
+
+    // Counters kept in a site's registry entry, so code that wants some
+    // state per site (such as failure throttling in hopefully.cpp) gets it
+    // without a map or a lock.  The null site has none.
+
+    struct site_counters final
+    {
+        std::atomic<uint64_t> failures;
+        std::atomic<uint64_t> reportedFailures;
+        std::atomic<int64_t> lastReportMsecs;
+        std::atomic<uint32_t> sampling; // see hopefullySampled
+        std::atomic<bool> summaryPending; // see flushHopeFailed
+        std::atomic<uint64_t> triageRecorded; // see onHopeFailedTriage
+    };
+
+    static site_counters * counters (codesite const & site);
+
+
 public:
     // I do not like this very much but default constructible is needed for
     // several purposes, including qRegisterMetaType.
@@ -116,6 +252,9 @@ public:
     // copy constructor is also public
     codeplace (codeplace const & other);
 
+    // moving leaves the other codeplace null
+    codeplace (codeplace && other) noexcept;
+
     // destructor has to be public
     ~codeplace ();
 
@@ -123,8 +262,12 @@ public:
 public:
     codeplace & operator= (codeplace const & rhs);
 
+    codeplace & operator= (codeplace && rhs) noexcept;
+
     int operator== (codeplace const & rhs) const;
 
+    uuid128 const & getUuid128 () const;
+
     QString getFilename () const;
 
     long getLine () const;
@@ -135,14 +278,46 @@ public:
 
     QString toString () const;
 
+    // What toString() gives, as UTF-8 written into the caller's buffer.  The
+    // result is always NUL terminated and gets cut short if it won't fit.
+    // Returns the number of bytes written, not counting the terminator.
+    // A null codeplace formats as "(no codeplace)".
+    size_t format (char * buffer, size_t size) const;
+
+    template <size_t N>
+    size_t format (char (&buffer)[N]) const {
+        return format(buffer, N);
+    }
+
+    // The uuid the way QUuid::toString() spells it, with the braces
+    size_t formatUuid (char * buffer, size_t size) const;
+
+    template <size_t N>
+    size_t formatUuid (char (&buffer)[N]) const {
+        return formatUuid(buffer, N);
+    }
+
+    // Valid for as long as this codeplace (or a copy of it) is
+    char const * getFilenameUtf8 () const;
+
+    static size_t const FormatBufferSize = 512;
+
+    static size_t const UuidFormatSize = 39;
+
     bool isPermanent () const;
 
+    bool isNull () const;
+
 
 private:
     void transitionToNull ();
 
     void transitionFromNull (codeplace const & other);
 
+    // Sets every member as the default constructor does, without freeing
+    // anything; for a codeplace whose filename was moved out or never held
+    void clearToNull ();
+
 
 protected:
     codeplace (
@@ -161,11 +336,30 @@ protected:
 
     codeplace (char const * filename, long const & line);
 
+    codeplace (
+        char const * filename,
+        long const & line,
+        uuid128 const & hashedUuid
+    );
+
+    codeplace (
+        char const * filename,
+        long const & line,
+        uuid128 const & uuid,
+        Options const & options
+    );
+
 private:
+    struct shared_filename;
+
     Options _options;
+
+    // codesite index if known, else 0 (fits in what would be padding)
+    uint32_t _siteIndex;
+
     union {
-        // dynamically allocated, we are responsible for freeing
-        QString* _filenameQString;
+        // reference counted, we are responsible for releasing our share
+        shared_filename * _filenameShared;
 
         // must be in constant pool, assumed valid forever
         char const * _filenameCString;
@@ -176,16 +370,9 @@ private:
 
     long _line; // boost::assert used long, I'm just following their lead
 
-    union {
-        // dynamically allocated, we are responsible for freeing
-        QString * _uuidQString;
-
-        // must be in constant pool, assumed valid forever
-        char const * _uuidCString;
-
-        // use this to copy or set null
-        void * _uuidEither;
-    };
+    // Decoded or hashed when the codeplace is made, so comparing and hashing
+    // codeplaces is just integer work.  All zero for a null codeplace.
+    uuid128 _uuidBits;
 };
 
 
@@ -224,6 +411,47 @@ inline codeplace::Options operator& (
 }
 
 
+
+
+// Equality and hashing are on the hot path when codeplaces are used as keys
+// in containers, so they are inline and touch only the cached bits.
+
+inline int codeplace::operator== (codeplace const & rhs) const {
+    // Should we allow comparisons of null codeplaces?
+
+    // TODO: current semantics is uuid equality, is that sensible?
+    // also what to do about null uuids?
+    return _uuidBits == rhs._uuidBits;
+}
+
+
+inline uuid128 const & codeplace::getUuid128 () const {
+    assert(_options != Options::None);
+    return _uuidBits;
+}
+
+
+
+
+inline codesite::codesite (codeplace const & cp) :
+    _index (
+        cp._siteIndex != 0 ? cp._siteIndex : codeplace::remember(cp)._index
+    )
+{
+}
+
+
+inline codesite::operator codeplace () const {
+    return codeplace::lookup(*this);
+}
+
+
+// Streams the toString() text without building a QString for it first.
+// A codesite gets here by way of its conversion to codeplace.
+
+QTextStream & operator<< (QTextStream & ts, codeplace const & cp);
+
+
 } // end namespace hoist
 
 
@@ -240,12 +468,21 @@ namespace std {
             hoist::codeplace const & cp
         ) const
         {
-            using Options = hoist::codeplace::Options;
-
-            if (cp._options == Options::None)
-                return 0;
+            // The bits are an MD4 digest or a random uuid, so folding the
+            // halves together is as well distributed as hashing them again.
+            // A null codeplace has zero bits and thus hashes to 0.
+            return static_cast<size_t>(cp._uuidBits.high ^ cp._uuidBits.low);
+        }
+    };
 
-            return qHash(cp.getUuid());
+    template <>
+    struct hash<hoist::codesite>
+    {
+        size_t operator()(
+            hoist::codesite const & site
+        ) const
+        {
+            return static_cast<size_t>(site._index);
         }
     };
 
@@ -265,9 +502,24 @@ namespace std {
 // invariant uuid as a parameter to distinguish the points (or just bumping to
 // the next line).
 //
+// The hash is computed by the compiler, so using HERE costs no more at
+// runtime than PLACE does.  The lambda is there to force the evaluation of
+// the constexpr; it gives the same uuid QCryptographicHash would.  It also
+// gives each site a static holding its codesite, from when it was
+// remembered in the registry the first time it ran.
+//
 
 #define HERE \
-    hoist::codeplace::makeHere(__FILE__, __LINE__)
+    ([]() -> hoist::codeplace { \
+        constexpr hoist::uuid128 hereUuid \
+            = hoist::Uuid128FromFileAndLine(__FILE__, __LINE__); \
+        static hoist::codesite const site = hoist::codeplace::remember( \
+            hoist::codeplace::makeHere(__FILE__, __LINE__, hereUuid) \
+        ); \
+        return hoist::codeplace::makeHere( \
+            __FILE__, __LINE__, hereUuid, site \
+        ); \
+    }())
 
 //
 // PLACE() is what you ideally use instead of HERE wherever possible.
@@ -283,9 +535,27 @@ namespace std {
 // between something() and somethingelse()... despite reporting a different
 // line and file.  That is of more value over the long run than using HERE.
 //
+// The uuid must be a string literal.  It is checked and decoded by the
+// compiler, so a malformed one is a build error and the 128 bits cost
+// nothing at runtime.  As with HERE, the lambda gives the site a static
+// holding its codesite.
+//
 
 #define PLACE(uuidString) \
-    hoist::codeplace::makePlace(__FILE__, __LINE__, (uuidString))
+    ([]() -> hoist::codeplace { \
+        static_assert( \
+            hoist::IsBase64Uuid(uuidString), \
+            "PLACE() requires a 22 character base64 uuid string literal" \
+        ); \
+        constexpr hoist::uuid128 placeUuid \
+            = hoist::Uuid128FromBase64(uuidString); \
+        static hoist::codesite const site = hoist::codeplace::remember( \
+            hoist::codeplace::makePlace(__FILE__, __LINE__, placeUuid) \
+        ); \
+        return hoist::codeplace::makePlace( \
+            __FILE__, __LINE__, placeUuid, site \
+        ); \
+    }())
 
 //
 // "THERE" is for cases where you want to talk about a remote source line and
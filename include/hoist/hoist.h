@@ -14,14 +14,18 @@
 #ifndef HOIST_HOIST_H
 #define HOIST_HOIST_H
 
+#include "uuid128.h"
 #include "codeplace.h"
 #include "hopefully.h"
 #include "tracked.h"
+#include "atomic_tracked.h"
 #include "stacked.h"
 #include "listed.h"
 #include "mapped.h"
 #include "cast_hopefully.h"
 #include "chronicle.h"
+#include "manifest.h"
+#include "triage.h"
 
 // we moc this file, though whether there are any QObjects or not may vary
 // this dummy object suppresses the warning "No relevant classes found" w/moc
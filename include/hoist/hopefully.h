@@ -20,15 +20,112 @@
 
 #include "codeplace.h"
 
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+// The failure path is kept out of line and marked cold, so a hopefully()
+// that holds compiles to a compare and a branch the compiler lays out as
+// the likely one.
+
+#if defined(__GNUC__) or defined(__clang__)
+    #define HOIST_COLD __attribute__((cold, noinline))
+#elif defined(_MSC_VER)
+    #define HOIST_COLD __declspec(noinline)
+#else
+    #define HOIST_COLD
+#endif
+
 namespace hoist {
 
-bool hopefullyNotReached (QString const & message, codeplace const & cp);
+// A message that is only made if it is going to be reported.  This refers
+// to the callable without copying it, so it must not outlive the call it
+// is passed to.
+
+class hope_message final
+{
+public:
+    template <typename F>
+    explicit hope_message (F const & make) :
+        _object (&make),
+        _make (&MakeWith<F>)
+    {
+    }
+
+    QString operator() () const {
+        return _make(_object);
+    }
+
+private:
+    template <typename F>
+    static QString MakeWith (void const * object) {
+        return QString ((*static_cast<F const *>(object))());
+    }
+
+private:
+    void const * _object;
+    QString (* _make) (void const *);
+};
+
+
+namespace detail {
+
+// Something that can be called with no arguments to get a message
+template <typename F, typename = void>
+struct is_message_maker : std::false_type {};
 
+template <typename F>
+struct is_message_maker<
+    F,
+    typename std::enable_if<
+        std::is_convertible<decltype(std::declval<F const &>()()), QString>
+            ::value
+    >::type
+> : std::true_type {};
 
-inline bool hopefullyNotReached (char const * message, codeplace const & cp) {
-    return hopefullyNotReached(QString (message), cp);
+inline void ApplyArgs (QString &) {
 }
 
+template <typename Arg, typename... Args>
+inline void ApplyArgs (
+    QString & message,
+    Arg const & arg,
+    Args const &... args
+) {
+    message = message.arg(arg);
+    ApplyArgs(message, args...);
+}
+
+} // end namespace detail
+
+
+// "%1 is out of range", x works the same as QString ("...").arg(x), except
+// that it is only done when the message is needed
+
+template <typename... Args>
+QString MessageFromFormat (char const * format, Args const &... args) {
+    QString message (format);
+    detail::ApplyArgs(message, args...);
+    return message;
+}
+
+
+HOIST_COLD bool hopefullyNotReached (
+    hope_message const & message,
+    codeplace const & cp
+);
+
+HOIST_COLD bool hopefullyNotReached (
+    QString const & message,
+    codeplace const & cp
+);
+
+// Out of line so that a throttled failure never builds the QString
+HOIST_COLD bool hopefullyNotReached (
+    char const * message,
+    codeplace const & cp
+);
+
 
 inline bool hopefullyNotReached (codeplace const & cp) {
     return hopefullyNotReached("Program Integrity Protection Triggered", cp);
@@ -40,7 +137,7 @@ inline bool hopefully (
     QString const & message,
     codeplace const & cp
 ) {
-    if (not condition)
+    if (Q_UNLIKELY(not condition))
         hopefullyNotReached(message, cp);
     return condition;
 }
@@ -51,19 +148,184 @@ inline bool hopefully (
     char const * message,
     codeplace const & cp
 ) {
-    if (not condition)
-        hopefullyNotReached(QString (message), cp);
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(message, cp);
     return condition;
 }
 
 
 inline bool hopefully (bool const condition, codeplace const & cp) {
-    if (not condition)
+    if (Q_UNLIKELY(not condition))
         hopefullyNotReached(cp);
     return condition;
 }
 
 
+// The message is made by calling makeMessage, only if the hope fails:
+//
+//     hopefully(count < limit, [&]() { return describe(count); }, HERE);
+
+template <
+    typename F,
+    typename = typename std::enable_if<detail::is_message_maker<F>::value>::type
+>
+inline bool hopefully (
+    bool const condition,
+    F const & makeMessage,
+    codeplace const & cp
+) {
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(hope_message (makeMessage), cp);
+    return condition;
+}
+
+
+// The format arguments go after the codeplace, and are only substituted
+// if the hope fails:
+//
+//     hopefully(count < limit, "count %1 hit limit %2", HERE, count, limit);
+
+template <typename Arg, typename... Args>
+inline bool hopefully (
+    bool const condition,
+    char const * format,
+    codeplace const & cp,
+    Arg const & arg,
+    Args const &... args
+) {
+    if (Q_UNLIKELY(not condition)) {
+        auto makeMessage = [&]() {
+            return MessageFromFormat(format, arg, args...);
+        };
+        hopefullyNotReached(hope_message (makeMessage), cp);
+    }
+    return condition;
+}
+
+
+// Taking a codesite directly means it is only turned into a codeplace when
+// the hope fails, instead of on every call
+
+inline bool hopefully (
+    bool const condition,
+    QString const & message,
+    codesite const & site
+) {
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(message, site);
+    return condition;
+}
+
+
+inline bool hopefully (
+    bool const condition,
+    char const * message,
+    codesite const & site
+) {
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(message, site);
+    return condition;
+}
+
+
+inline bool hopefully (bool const condition, codesite const & site) {
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(site);
+    return condition;
+}
+
+
+template <
+    typename F,
+    typename = typename std::enable_if<detail::is_message_maker<F>::value>::type
+>
+inline bool hopefully (
+    bool const condition,
+    F const & makeMessage,
+    codesite const & site
+) {
+    if (Q_UNLIKELY(not condition))
+        hopefullyNotReached(hope_message (makeMessage), site);
+    return condition;
+}
+
+
+template <typename Arg, typename... Args>
+inline bool hopefully (
+    bool const condition,
+    char const * format,
+    codesite const & site,
+    Arg const & arg,
+    Args const &... args
+) {
+    if (Q_UNLIKELY(not condition)) {
+        auto makeMessage = [&]() {
+            return MessageFromFormat(format, arg, args...);
+        };
+        hopefullyNotReached(hope_message (makeMessage), site);
+    }
+    return condition;
+}
+
+
+// For checks that are too expensive to run every time, such as walking a
+// container to test an invariant.  The check is a callable returning bool,
+// and whether it runs is decided per site from a setting in the registry
+// that can be changed while the program runs: 0 means the check is off, 1
+// that it runs every time, and N that it runs at random about one time in
+// N.  Sites that haven't been given a setting use the default, which is 1.
+// A check that doesn't run counts as having held.
+
+bool hopeSampleDue (codesite const & site);
+
+bool setHopeSampling (codeplace const & cp, uint32_t every);
+
+// false if no site with that uuid has been seen in this run yet
+bool setHopeSampling (uuid128 const & uuid, uint32_t every);
+
+void setDefaultHopeSampling (uint32_t every);
+
+
+template <typename Check>
+inline bool hopefullySampled (
+    Check const & check,
+    char const * message,
+    codesite const & site
+) {
+    if (not hopeSampleDue(site))
+        return true;
+    return hopefully(static_cast<bool>(check()), message, site);
+}
+
+
+template <typename Check>
+inline bool hopefullySampled (Check const & check, codesite const & site) {
+    if (not hopeSampleDue(site))
+        return true;
+    return hopefully(static_cast<bool>(check()), site);
+}
+
+
+template <typename Check>
+inline bool hopefullySampled (
+    Check const & check,
+    char const * message,
+    codeplace const & cp
+) {
+    if (not hopeSampleDue(codesite (cp)))
+        return true;
+    return hopefully(static_cast<bool>(check()), message, cp);
+}
+
+
+template <typename Check>
+inline bool hopefullySampled (Check const & check, codeplace const & cp) {
+    if (not hopeSampleDue(codesite (cp)))
+        return true;
+    return hopefully(static_cast<bool>(check()), cp);
+}
+
+
 // hopefullyAlter and hopefullyTransition were inspired by tracked<T>, but
 // were useful for general assignments also.
 
@@ -91,6 +353,106 @@ inline bool hopefullyTransition (
 }
 
 
+// For std::atomic the check and the write are one compare-and-swap, so a
+// transition that loses a race to another thread is caught instead of
+// being written over.  Unlike the forms above, a failed transition leaves
+// the variable alone (it holds what the other thread put there), and the
+// report says what value was actually found.  On success this costs what
+// the compare_exchange_strong does.
+
+namespace detail {
+
+// enum class values can't be streamed, so they go out as their number
+
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type StreamValue (
+    QTextStream & ts,
+    T const & value
+) {
+    ts << static_cast<qlonglong>(value);
+}
+
+template <typename T>
+inline typename std::enable_if<not std::is_enum<T>::value>::type StreamValue (
+    QTextStream & ts,
+    T const & value
+) {
+    ts << value;
+}
+
+
+template <typename T, typename U, typename V>
+HOIST_COLD bool HopeTransitionFailed (
+    T const & seen,
+    U const & oldValue,
+    V const & newValue,
+    codeplace const & cp
+) {
+    auto makeMessage = [&]() {
+        QString message;
+        QTextStream ts (&message);
+        ts << "Expected transition from ";
+        StreamValue(ts, oldValue);
+        ts << " to ";
+        StreamValue(ts, newValue);
+        ts << " but the value was ";
+        StreamValue(ts, seen);
+        ts.flush();
+        return message;
+    };
+    return hopefullyNotReached(hope_message (makeMessage), cp);
+}
+
+
+template <typename T>
+HOIST_COLD bool HopeAlterFailed (T const & seen, codeplace const & cp) {
+    auto makeMessage = [&]() {
+        QString message;
+        QTextStream ts (&message);
+        ts << "Expected value to change but it was already ";
+        StreamValue(ts, seen);
+        ts.flush();
+        return message;
+    };
+    return hopefullyNotReached(hope_message (makeMessage), cp);
+}
+
+} // end namespace detail
+
+
+template <typename T, typename U>
+inline bool hopefullyAlter (
+    std::atomic<T> & variable,
+    U const & value,
+    codeplace const & cp,
+    std::memory_order const order = std::memory_order_acq_rel
+) {
+    T const desired = value;
+    T const previous = variable.exchange(desired, order);
+    if (Q_LIKELY(previous != desired))
+        return true;
+    return detail::HopeAlterFailed(previous, cp);
+}
+
+template <typename T, typename U, typename V>
+inline bool hopefullyTransition (
+    std::atomic<T> & variable,
+    U const & oldValue,
+    V const & newValue,
+    codeplace const & cp,
+    std::memory_order const order = std::memory_order_acq_rel
+) {
+    // The single order form derives a failure order that's valid for it
+    T expected = oldValue;
+    if (
+        Q_LIKELY(variable.compare_exchange_strong(expected, newValue, order))
+    ) {
+        return true;
+    }
+    return detail::HopeTransitionFailed(expected, oldValue, newValue, cp);
+}
+
+
 // default hope failed handler is not very interesting, you can make your own
 
 typedef void (* hope_failed_handler) (
@@ -108,6 +470,109 @@ inline void setHopeFailedHandler (hope_failed_handler const & newHandler) {
     static_cast<void>(setHopeFailedHandlerAndReturnOldHandler(newHandler));
 }
 
+
+// Overrides the handler for the current thread only, for as long as it is
+// in scope.  They nest, with the innermost one winning, and must be
+// destroyed on the thread that made them (in the reverse order, which
+// scoping takes care of).  Failures under one are delivered on the failing
+// thread even if the asynchronous mode is on.
+//
+//     scoped_hope_failed_handler quiet (&countFailures);
+
+class scoped_hope_failed_handler final
+{
+    Q_DISABLE_COPY(scoped_hope_failed_handler)
+
+public:
+    explicit scoped_hope_failed_handler (hope_failed_handler const & handler);
+
+    ~scoped_hope_failed_handler ();
+
+    hope_failed_handler handler () const;
+
+private:
+    hope_failed_handler const _handler;
+    scoped_hope_failed_handler * const _previous;
+};
+
+
+// The default handler, for handlers that want to fall back on it
+
+void onHopeFailedBasic (QString const & message, codeplace const & cp);
+
+
+// A hope that fails in a loop under a handler that doesn't halt could call
+// the handler millions of times with the same report.  Each site counts
+// its failures (an atomic add in the site's registry entry), and with
+// limits set only the first reportFirst of them reach the handler.  After
+// that the handler gets one summary per summaryMsecs at most, saying how
+// many failures there were since the last report.  Failures held back
+// since the last summary are reported by flushHopeFailed().
+//
+// By default every failure is delivered (reportFirst is UINT64_MAX).  A
+// negative summaryMsecs means no summaries.
+
+void setHopeFailedLimits (uint64_t reportFirst, int64_t summaryMsecs);
+
+
+// Exact, including the failures that weren't passed on to the handler
+
+uint64_t hopeFailedCount (codeplace const & cp);
+
+
+// A handler that does I/O will stall whatever thread had the failure.  In
+// asynchronous mode the failing thread only copies a record into a bounded
+// lock-free queue, and a background thread hands the records to the handler
+// (or to a batch handler, if one is given) in order.
+//
+// Every failure goes through the queue while the thread is running, as long
+// as there is something other than the default handler to deliver it to:
+// a handler that has been set, or the batch handler.  The default handler
+// halts the program, so with neither it runs on the failing thread; it
+// flushes the queue first, so that failures which came before a fatal one
+// are seen.  A failure on the delivery thread itself, or on a thread with a
+// scoped_hope_failed_handler, is also delivered directly.
+//
+// The place is the codeplace as the failure had it.  site is its codesite,
+// or null for one that isn't remembered in the registry (a YONDER, or a
+// null codeplace).
+
+struct hope_failed_record
+{
+    codesite site;
+    codeplace place;
+    QString message;
+    Qt::HANDLE thread;
+    qint64 msecsSinceEpoch;
+};
+
+typedef void (* hope_failed_batch_handler) (
+    hope_failed_record const * records,
+    size_t count
+);
+
+enum class hope_failed_overflow {
+    Drop, // count it in hopeFailedDropCount() and keep going
+    Block // wait for the delivery thread to make room
+};
+
+// capacity is rounded up to a power of two; a second start is ignored
+void startHopeFailedThread (
+    size_t capacity = 1024,
+    hope_failed_overflow overflow = hope_failed_overflow::Drop,
+    hope_failed_batch_handler batchHandler = nullptr
+);
+
+// Delivers everything queued so far, then ends the thread
+void stopHopeFailedThread ();
+
+// Sends a summary for each site with failures held back by the limits
+// above, then returns once everything queued before the call (and those
+// summaries) has been delivered.  Works with or without the thread.
+void flushHopeFailed ();
+
+uint64_t hopeFailedDropCount ();
+
 } // end namespace hoist
 
 #endif
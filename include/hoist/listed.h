@@ -5,11 +5,11 @@
 //  of the list at a moment in time.  If these semantics are not suitable
 //  then you have to tackle it with additional synchronization logic.
 //  The object requirements are the same as for tracked (copyable,
-//  QTextStream output operator).  In order to achieve thread safety,
-//  you will be paying for 2 copies of the value by virtue of using the
-//  listed type.  However, implicit sharing means you can often
-//  leverage that second copy as the same copy from the list of
-//  objects you retrieve when you call getList()
+//  QTextStream output operator).  The list hands out each value as it
+//  was when the instance was constructed, so each instance keeps one
+//  copy of it, shared with every snapshot that has it.  However,
+//  implicit sharing means that for most Qt types that copy shares its
+//  data with the instance's own.
 //
 //          Copyright (c) 2009-2014 HostileFork.com
 // Distributed under the Boost Software License, Version 1.0.
@@ -25,31 +25,44 @@
 #include "codeplace.h"
 #include "hopefully.h"
 #include "tracked.h"
+#include "snapshot.h"
 
-#include <QReadWriteLock>
+#include <QMutex>
+
+#include <memory>
 
 namespace hoist {
 
 template <class T>
 class listed : public tracked<T>
 {
+    // a copy would share the original's place in the list
+    Q_DISABLE_COPY(listed)
+
 public:
     class manager
     {
         Q_DISABLE_COPY(manager)
 
     public:
-        manager ()
+        // In order of construction
+        typedef snapshot_list<tracked<T>> snapshot_type;
+
+    public:
+        manager () :
+            first (nullptr),
+            last (nullptr),
+            count (0)
         {
         }
 
         virtual ~manager () {
-            for (listed<T> * ptr : list) {
+            for (listed<T> * ptr = first; ptr; ptr = ptr->_next) {
                 // This test should always fail, but reports the
                 // allocation point during the failure
                 ptr->hopefullyNotEqualTo(*ptr, HERE);
             }
-            hopefully(resultCache.empty(), HERE);
+            hopefully(count == 0, HERE);
         }
 
 
@@ -59,20 +72,41 @@ public:
         // onto them.  Also... due to semantics we can't give listed
         // instances back because then they'd get into the list also.  Yet
         // if they're in a QList, then that's the only thing distinguishing
-        // them from a tracked... so we upcast and copy construct
-        QList<tracked<T>> getList ()
+        // them from a tracked... so we upcast and copy construct.
+        //
+        // Until the list changes again, every call gets the same snapshot
+        // with an atomic load.  The first call after a change builds it,
+        // copying a handle to each instance's value under the lock.
+        snapshot_type getSnapshot () const
+        {
+            return snapshots.get(listLock, [this]() {
+                typename snapshot_type::entries entries;
+                entries.reserve(count);
+                for (listed<T> * ptr = first; ptr; ptr = ptr->_next)
+                    entries.push_back(ptr->_cached);
+                return snapshot_type (std::move(entries));
+            });
+        }
+
+        // Copies the values out of the snapshot, so it costs O(n)
+        QList<tracked<T>> getList () const
         {
-            QReadLocker lock (&listLock);
+            snapshot_type const snapshot = getSnapshot();
 
-            // Makes a thread-safe copy before the unlock
-            return resultCache;
+            QList<tracked<T>> result;
+            result.reserve(static_cast<int>(snapshot.size()));
+            for (tracked<T> const & value : snapshot)
+                result.append(value);
+            return result;
         }
 
 
     private:
-        QReadWriteLock listLock;
-        QList<listed<T> *> list;
-        QList<tracked<T>> resultCache;
+        mutable QMutex listLock;
+        listed<T> * first;
+        listed<T> * last;
+        size_t count;
+        detail::snapshot_cache<snapshot_type> snapshots;
         friend class listed;
     };
 
@@ -84,26 +118,56 @@ public:
         codeplace const & cp
     ) :
         tracked<T> (value, cp),
-        mgr (mgr)
+        mgr (mgr),
+        _cached (
+            std::make_shared<tracked<T> const>(
+                static_cast<tracked<T> const &>(*this)
+            )
+        ),
+        _next (nullptr)
     {
-        QWriteLocker lock (&mgr.listLock);
-
-        mgr.list.append(this);
-        mgr.resultCache.append(*static_cast<tracked<T> *>(this));
+        QMutexLocker lock (&mgr.listLock);
+
+        // linked in at the end, so snapshots are in order of construction
+        _prev = mgr.last;
+        if (_prev)
+            _prev->_next = this;
+        else
+            mgr.first = this;
+        mgr.last = this;
+        mgr.count++;
+        mgr.snapshots.changed();
     }
 
 
-    ~listed() override {
-        QWriteLocker lock (&mgr.listLock);
-
-        int indexToRemove = mgr.list.indexOf(this);
-        hopefully(indexToRemove != -1, HERE);
-        mgr.list.removeAt(indexToRemove);
-        mgr.resultCache.removeAt(indexToRemove);
+    // Unlinking is constant time however many instances there are
+    ~listed() {
+        QMutexLocker lock (&mgr.listLock);
+
+        hopefully(mgr.count != 0, HERE);
+        if (_prev)
+            _prev->_next = _next;
+        else
+            mgr.first = _next;
+        if (_next)
+            _next->_prev = _prev;
+        else
+            mgr.last = _prev;
+        mgr.count--;
+        mgr.snapshots.changed();
     }
 
 private:
     manager & mgr;
+
+    // What snapshots hand out.  The instance's own value can be assigned
+    // by its owner without any lock, so snapshots can't read that one;
+    // this is written only here, and shared with the snapshots rather
+    // than copied into them.  Each instance links itself into its
+    // manager's list, so registering it allocates nothing else.
+    std::shared_ptr<tracked<T> const> const _cached;
+    listed<T> * _prev;
+    listed<T> * _next;
 };
 
 } // end namespace hoist
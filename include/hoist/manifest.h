@@ -0,0 +1,86 @@
+//
+//  manifest.h - A compact binary index of the PLACE and HERE sites in a
+//      source tree, so that a uuid from a field report can be resolved
+//      to a file, line and function without grepping the sources.  The
+//      manifest is written once by scanning the tree, and read by mapping
+//      the file into memory with no parsing at startup.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_MANIFEST_H
+#define HOIST_MANIFEST_H
+
+#include "uuid128.h"
+#include "codeplace.h"
+
+#include <QString>
+#include <QFile>
+
+namespace hoist {
+
+//
+// Scans every C++ source and header under sourceRoot on all available
+// cores, and writes the manifest.  PLACE sites are keyed by their literal
+// uuid.  HERE sites are keyed by the same hash the compiler calculates,
+// which depends on how __FILE__ is spelled in the build; the hashed
+// filename is filenamePrefix followed by the path relative to sourceRoot.
+// If no prefix is given, the absolute path of sourceRoot (plus a slash) is
+// used, which matches builds that compile files by absolute path.
+//
+// Returns false if the manifest could not be written.
+//
+
+bool WriteCodeplaceManifest (
+    QString const & sourceRoot,
+    QString const & manifestPath,
+    QString const & filenamePrefix = QString ()
+);
+
+
+class codeplace_manifest final
+{
+    Q_DISABLE_COPY(codeplace_manifest)
+
+public:
+    // The strings point into the mapped file and are only valid for the
+    // lifetime of the codeplace_manifest.
+    struct entry
+    {
+        char const * filename;
+        long line;
+        char const * function; // empty if not inside a function
+        bool isPermanent; // PLACE, as opposed to HERE
+    };
+
+public:
+    explicit codeplace_manifest (QString const & manifestPath);
+
+    ~codeplace_manifest ();
+
+public:
+    // false if the file is missing, or isn't a manifest of this version
+    bool isValid () const;
+
+    size_t size () const;
+
+    // Binary search on the sorted ids, false if the uuid isn't in it
+    bool lookup (uuid128 const & uuid, entry & result) const;
+
+    bool lookup (QUuid const & uuid, entry & result) const;
+
+private:
+    QFile _file;
+    uchar const * _data;
+    qint64 _dataSize;
+    size_t _count;
+};
+
+} // end namespace hoist
+
+#endif
@@ -23,20 +23,29 @@
 #include "codeplace.h"
 #include "hopefully.h"
 #include "tracked.h"
+#include "snapshot.h"
 
-#include <QReadWriteLock>
+#include <QMutex>
 #include <QMap>
 
+#include <memory>
+
 namespace hoist {
 
 template <class Key, class T>
-class mapped : public tracked<T>
+class mapped : public tracked<T, codeplace, 1, false, mapped<Key, T>>
 {
+    typedef tracked<T, codeplace, 1, false, mapped<Key, T>> tracked_type;
+    friend tracked_type;
+
 public:
     class manager
     {
         Q_DISABLE_COPY(manager)
 
+    public:
+        typedef snapshot_map<Key, tracked<T>> snapshot_type;
+
     public:
         manager()
         {
@@ -44,8 +53,8 @@ public:
 
         virtual ~manager ()
         {
-            for (tracked<T> value : _resultCache) {
-                value.hopefullyNotEqualTo(value, HERE);
+            for (auto const & entry : _map) {
+                entry->hopefullyNotEqualTo(*entry, HERE);
             }
         }
 
@@ -59,27 +68,45 @@ public:
         // them from a tracked... so we upcast and copy construct.  This drops
         // the key but since you have the QMap the key will be available
         // during any iteration.
+        //
+        // Until the map changes again, every call gets the same snapshot
+        // with an atomic load.  The first call after a change builds it,
+        // copying a handle to each value under the lock.  Its iterators
+        // have key() as well as value(), like a QMap's.
+
+        snapshot_type getSnapshot () const {
+            return _snapshots.get(_mapLock, [this]() {
+                typename snapshot_type::entries entries;
+                entries.reserve(static_cast<size_t>(_map.size()));
+                for (auto iter = _map.begin(); iter != _map.end(); ++iter)
+                    entries.emplace_back(iter.key(), iter.value());
+                return snapshot_type (std::move(entries));
+            });
+        }
 
+        // Copies the values out of the snapshot, so it costs O(n)
         QMap<Key, tracked<T>> getMap () const {
-            QReadLocker lock (&_mapLock);
+            snapshot_type const snapshot = getSnapshot();
 
-            // The return will make a thread-safe copy before releasing the
-            // lock in its destructor
-            return _resultCache;
+            QMap<Key, tracked<T>> result;
+            for (auto iter = snapshot.begin(); iter != snapshot.end(); ++iter)
+                result.insert(iter.key(), iter.value());
+            return result;
         }
 
 
+        // Lookups hold the lock only to find the entry and take a handle
+        // to its value, so they don't make the map build a snapshot
+
         const T lookupValue (
             Key const & key,
             T const & defaultValue
         ) {
-            QReadLocker lock (&_mapLock);
-
-            auto iter = _resultCache.find(key);
-            if (iter == _resultCache.end())
+            entry_type const found = lookupEntry(key);
+            if (not found)
                 return defaultValue;
-            
-            return iter.value().get();
+
+            return found->get();
         }
 
 
@@ -89,19 +116,28 @@ public:
         )
             const
         {
-            QReadLocker lock (&_mapLock);
-
-            auto iter = _resultCache.find(key);
-            if (iter == _resultCache.end())
+            entry_type const found = lookupEntry(key);
+            if (not found)
                 throw hopefullyNotReached(cp);
-            
-            return iter.value();
+
+            return *found;
         }
 
 
     private:
-        mutable QReadWriteLock _mapLock;
-        QMap<Key, tracked<T>> _resultCache;
+        typedef std::shared_ptr<tracked<T> const> entry_type;
+
+        entry_type lookupEntry (Key const & key) const {
+            QMutexLocker lock (&_mapLock);
+
+            auto iter = _map.find(key);
+            return iter == _map.end() ? entry_type () : iter.value();
+        }
+
+    private:
+        mutable QMutex _mapLock;
+        QMap<Key, entry_type> _map;
+        detail::snapshot_cache<snapshot_type> _snapshots;
         friend class mapped;
     };
 
@@ -113,24 +149,26 @@ public:
         manager & mgr,
         codeplace const & cp
     ) :
-        tracked<T> (value, cp),
+        tracked_type (value, cp),
         _mgr (mgr),
         _key (key)
     {
-        QWriteLocker lock (&_mgr._mapLock);
+        QMutexLocker lock (&_mgr._mapLock);
         hopefully(
-            not _mgr._resultCache.contains(_key),
+            not _mgr._map.contains(_key),
             "mapped<> item already exists with key",
             cp
         );
-        _mgr._resultCache.insert(_key, *static_cast<tracked<T> *>(this));
+        _mgr._map.insert(_key, makeEntry());
+        _mgr._snapshots.changed();
     }
 
 
-    ~mapped () override
+    ~mapped ()
     {
-        QWriteLocker lock (&_mgr.mapLock);
-        hopefully(_mgr._resultCache.remove(_key) == 1, HERE);
+        QMutexLocker lock (&_mgr._mapLock);
+        hopefully(_mgr._map.remove(_key) == 1, HERE);
+        _mgr._snapshots.changed();
     }
 
 
@@ -140,13 +178,26 @@ public:
         return _key;
     }
 
-    virtual void assign (T const & newValue, codeplace const & cp) override
+
+private:
+    // The manager's copy of the value.  Snapshots share it, and an assign
+    // replaces it with a new one rather than changing it under them.
+    typename manager::entry_type makeEntry () const
+    {
+        return std::make_shared<tracked<T> const>(tracked<T> (*this));
+    }
+
+    // Called by tracked_type after each assign(), to replace the copy that
+    // the manager hands out
+    void onAssigned (codeplace const & cp)
     {
-        tracked<T>::assign(newValue, cp);
+        typename manager::entry_type entry = makeEntry();
 
-        QWriteLocker lock (&_mgr.mapLock);
-        hopefully(1 == _mgr._resultCache.remove(_key), cp);
-        _mgr._resultCache.insert(_key, *static_cast<tracked<T> *>(this));
+        QMutexLocker lock (&_mgr._mapLock);
+        auto iter = _mgr._map.find(_key);
+        if (hopefully(iter != _mgr._map.end(), cp))
+            iter.value() = std::move(entry);
+        _mgr._snapshots.changed();
     }
 
 
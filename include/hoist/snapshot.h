@@ -0,0 +1,315 @@
+//
+// snapshot.h - Immutable, reference counted snapshots of the registries
+//  kept by listed and mapped.  Writers only mark the registry as changed;
+//  the first reader after a change builds a new snapshot, and every reader
+//  until the next change shares that same one with an atomic load.  A
+//  snapshot holds handles to the values, never copies of them, and stays
+//  valid for as long as a reader holds onto it.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_SNAPSHOT_H
+#define HOIST_SNAPSHOT_H
+
+#include <QMutex>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace hoist {
+
+//
+// The values of a listed registry, in order of construction.  Copying one
+// is a reference count, and iterating it gives the values.
+//
+
+template <class Value>
+class snapshot_list final
+{
+public:
+    typedef std::vector<std::shared_ptr<Value const>> entries;
+
+    class const_iterator
+    {
+    public:
+        const_iterator ()
+        {
+        }
+
+        Value const & operator* () const {
+            return **_iter;
+        }
+
+        Value const * operator-> () const {
+            return _iter->get();
+        }
+
+        const_iterator & operator++ () {
+            ++_iter;
+            return *this;
+        }
+
+        bool operator== (const_iterator const & other) const {
+            return _iter == other._iter;
+        }
+
+        bool operator!= (const_iterator const & other) const {
+            return _iter != other._iter;
+        }
+
+    private:
+        explicit const_iterator (typename entries::const_iterator iter) :
+            _iter (iter)
+        {
+        }
+
+        typename entries::const_iterator _iter;
+        friend class snapshot_list;
+    };
+
+public:
+    snapshot_list ()
+    {
+    }
+
+    explicit snapshot_list (entries values) :
+        _entries (std::make_shared<entries const>(std::move(values)))
+    {
+    }
+
+    size_t size () const {
+        return _entries ? _entries->size() : 0;
+    }
+
+    bool isEmpty () const {
+        return size() == 0;
+    }
+
+    const_iterator begin () const {
+        return _entries
+            ? const_iterator (_entries->begin())
+            : const_iterator ();
+    }
+
+    const_iterator end () const {
+        return _entries ? const_iterator (_entries->end()) : const_iterator ();
+    }
+
+
+public:
+    // For the one a registry caches, which readers load while another
+    // reader may be storing a newer one
+    snapshot_list loadAtomic () const {
+        return snapshot_list (std::atomic_load(&_entries));
+    }
+
+    void storeAtomic (snapshot_list const & next) {
+        std::atomic_store(&_entries, next._entries);
+    }
+
+
+private:
+    explicit snapshot_list (std::shared_ptr<entries const> shared) :
+        _entries (std::move(shared))
+    {
+    }
+
+    std::shared_ptr<entries const> _entries;
+};
+
+
+//
+// The entries of a mapped registry, in key order (Key needs operator<).
+// Iterating gives the values, like iterating a QMap, and the iterators
+// have key() and value().  find() is a binary search.
+//
+
+template <class Key, class Value>
+class snapshot_map final
+{
+public:
+    typedef std::vector<std::pair<Key, std::shared_ptr<Value const>>> entries;
+
+    class const_iterator
+    {
+    public:
+        const_iterator ()
+        {
+        }
+
+        Value const & operator* () const {
+            return *_iter->second;
+        }
+
+        Value const * operator-> () const {
+            return _iter->second.get();
+        }
+
+        Key const & key () const {
+            return _iter->first;
+        }
+
+        Value const & value () const {
+            return *_iter->second;
+        }
+
+        const_iterator & operator++ () {
+            ++_iter;
+            return *this;
+        }
+
+        bool operator== (const_iterator const & other) const {
+            return _iter == other._iter;
+        }
+
+        bool operator!= (const_iterator const & other) const {
+            return _iter != other._iter;
+        }
+
+    private:
+        explicit const_iterator (typename entries::const_iterator iter) :
+            _iter (iter)
+        {
+        }
+
+        typename entries::const_iterator _iter;
+        friend class snapshot_map;
+    };
+
+public:
+    snapshot_map ()
+    {
+    }
+
+    // The entries must already be in key order, as a QMap iterates
+    explicit snapshot_map (entries sorted) :
+        _entries (std::make_shared<entries const>(std::move(sorted)))
+    {
+    }
+
+    size_t size () const {
+        return _entries ? _entries->size() : 0;
+    }
+
+    bool isEmpty () const {
+        return size() == 0;
+    }
+
+    const_iterator begin () const {
+        return _entries
+            ? const_iterator (_entries->begin())
+            : const_iterator ();
+    }
+
+    const_iterator end () const {
+        return _entries ? const_iterator (_entries->end()) : const_iterator ();
+    }
+
+    // null if there's no entry for the key
+    Value const * find (Key const & key) const {
+        if (not _entries)
+            return nullptr;
+        auto const iter = std::lower_bound(
+            _entries->begin(),
+            _entries->end(),
+            key,
+            [](typename entries::value_type const & entry, Key const & wanted) {
+                return entry.first < wanted;
+            }
+        );
+        if (iter == _entries->end() or key < iter->first)
+            return nullptr;
+        return iter->second.get();
+    }
+
+    bool contains (Key const & key) const {
+        return find(key) != nullptr;
+    }
+
+
+public:
+    // For the one a registry caches, which readers load while another
+    // reader may be storing a newer one
+    snapshot_map loadAtomic () const {
+        return snapshot_map (std::atomic_load(&_entries));
+    }
+
+    void storeAtomic (snapshot_map const & next) {
+        std::atomic_store(&_entries, next._entries);
+    }
+
+
+private:
+    explicit snapshot_map (std::shared_ptr<entries const> shared) :
+        _entries (std::move(shared))
+    {
+    }
+
+    std::shared_ptr<entries const> _entries;
+};
+
+
+namespace detail {
+
+// Changes are counted in an epoch.  The snapshot remembers the epoch it
+// was built at, and a reader that finds them equal takes the snapshot with
+// an atomic load.  So a writer pays one increment, and a registry that is
+// polled more often than it changes is only walked once per change.
+
+template <class Snapshot>
+class snapshot_cache final
+{
+    Q_DISABLE_COPY(snapshot_cache)
+
+public:
+    snapshot_cache () :
+        _epoch (1),
+        _builtEpoch (0)
+    {
+    }
+
+    // Called by writers, holding the lock that is passed to get()
+    void changed () {
+        _epoch.fetch_add(1, std::memory_order_release);
+    }
+
+    // build() gives a Snapshot of the registry as it is, and is called
+    // with the writers' lock held.  It only copies handles, not values.
+    template <typename Build>
+    Snapshot get (QMutex & writeLock, Build build) const {
+        if (
+            _builtEpoch.load(std::memory_order_acquire)
+            == _epoch.load(std::memory_order_acquire)
+        ) {
+            return _snapshot.loadAtomic();
+        }
+
+        QMutexLocker lock (&writeLock);
+        uint64_t const epoch = _epoch.load(std::memory_order_relaxed);
+        if (_builtEpoch.load(std::memory_order_relaxed) != epoch) {
+            _snapshot.storeAtomic(build());
+            _builtEpoch.store(epoch, std::memory_order_release);
+        }
+        return _snapshot.loadAtomic();
+    }
+
+private:
+    std::atomic<uint64_t> _epoch;
+    mutable std::atomic<uint64_t> _builtEpoch;
+    mutable Snapshot _snapshot;
+};
+
+} // end namespace detail
+
+} // end namespace hoist
+
+#endif
@@ -102,7 +102,7 @@ public:
         _mgr._map[thread].push_front(*static_cast<tracked<T> *>(this));
     }
 
-    ~stacked () override {
+    ~stacked () {
         QThread * thread = QThread::currentThread();
 
         QWriteLocker lock (&_mgr._mapLock);
@@ -113,9 +113,9 @@ public:
             QTextStream ts (&message);
             ts
                 << "expected stacked type constructed at "
-                << stack.front().whereConstructed().toString()
+                << stack.front().whereConstructed()
                 << " to have been destroyed before the one constructed at "
-                << this->whereConstructed().toString()
+                << this->whereConstructed()
                 << " (which is currently being destroyed)";
             hopefullyNotReached(message, this->whereConstructed());
         }
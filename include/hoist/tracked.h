@@ -24,23 +24,445 @@
 #include "codeplace.h"
 #include "hopefully.h"
 
+#include <QDateTime>
+
+#include <atomic>
+#include <functional>
+
 namespace hoist {
 
-template <class T>
-class tracked
+// What tracked::watch() gives back.  The watch lasts until this is
+// destroyed or cancel() is called, or until the tracked goes away.
+
+class tracked_watch final
 {
+    Q_DISABLE_COPY(tracked_watch)
+
 public:
-    tracked (T const & value, codeplace const & cp) :
-        _value (value),
+    tracked_watch () :
+        _id (0)
+    {
+    }
+
+    explicit tracked_watch (uint64_t const id) :
+        _id (id)
+    {
+    }
+
+    tracked_watch (tracked_watch && other) :
+        _id (other._id)
+    {
+        other._id = 0;
+    }
+
+    tracked_watch & operator= (tracked_watch && other) {
+        if (this != &other) {
+            cancel();
+            _id = other._id;
+            other._id = 0;
+        }
+        return *this;
+    }
+
+    ~tracked_watch () {
+        cancel();
+    }
+
+    void cancel ();
+
+    bool isNull () const {
+        return _id == 0;
+    }
+
+private:
+    uint64_t _id;
+};
+
+
+namespace detail {
+
+// Watches are kept in one table for the whole program, keyed by the
+// address of the tracked, so a tracked that isn't watched carries nothing
+// for them.  Assignments only look at the table while this is nonzero.
+
+extern std::atomic<int> trackedWatchCount;
+
+inline bool TrackedWatchesActive () {
+    return trackedWatchCount.load(std::memory_order_relaxed) != 0;
+}
+
+typedef std::function<void (void const * value, codeplace const & cp)>
+    tracked_watch_function;
+
+uint64_t AddTrackedWatch (
+    void const * object,
+    tracked_watch_function && notify
+);
+
+HOIST_COLD void NotifyTrackedWatches (
+    void const * object,
+    void const * value,
+    codeplace const & cp
+);
+
+HOIST_COLD void ForgetTrackedWatches (void const * object);
+
+
+// When Timestamps is false this is empty, and costs nothing as a base
+
+template <bool Timestamps>
+class tracked_clock
+{
+public:
+    void stamp () {
+    }
+
+    qint64 when () const {
+        return 0;
+    }
+};
+
+template <>
+class tracked_clock<true>
+{
+public:
+    tracked_clock () :
+        _msecs (QDateTime::currentMSecsSinceEpoch())
+    {
+    }
+
+    void stamp () {
+        _msecs = QDateTime::currentMSecsSinceEpoch();
+    }
+
+    qint64 when () const {
+        return _msecs;
+    }
+
+private:
+    qint64 _msecs;
+};
+
+
+template <class T, class Place, bool Timestamps>
+struct tracked_entry : tracked_clock<Timestamps>
+{
+    T value;
+    Place where;
+};
+
+
+// The assignments before the current one, in a fixed ring so that nothing
+// is allocated.  The clock it derives from is the current value's.
+
+template <class T, class Place, size_t Length, bool Timestamps>
+class tracked_history : public tracked_clock<Timestamps>
+{
+    static_assert(Length >= 1, "a tracked history has at least one entry");
+
+public:
+    typedef tracked_entry<T, Place, Timestamps> entry;
+
+    tracked_history () :
+        _count (0),
+        _newest (0)
+    {
+    }
+
+    size_t previousCount () const {
+        return _count;
+    }
+
+    // age 1 is the assignment before the current one
+    entry const & previous (size_t const age) const {
+        assert(age >= 1 and age <= _count);
+        return _ring[(_newest + (Length - 1) - (age - 1)) % (Length - 1)];
+    }
+
+    void push (T && oldValue, Place const & oldWhere) {
+        _newest = (_count == 0) ? 0 : (_newest + 1) % (Length - 1);
+        if (_count < Length - 1)
+            _count++;
+
+        entry & slot = _ring[_newest];
+        slot.value = std::move(oldValue);
+        slot.where = oldWhere;
+        static_cast<tracked_clock<Timestamps> &>(slot) = *this;
+        this->stamp();
+    }
+
+private:
+    entry _ring[Length - 1];
+    size_t _count;
+    size_t _newest;
+};
+
+
+template <class T, class Place, bool Timestamps>
+class tracked_history<T, Place, 1, Timestamps>
+    : public tracked_clock<Timestamps>
+{
+public:
+    typedef tracked_entry<T, Place, Timestamps> entry;
+
+    size_t previousCount () const {
+        return 0;
+    }
+
+    // There is no previous(), as there are no entries to give back
+
+    // nothing is kept, so the value isn't really moved from
+    template <class Where>
+    void push (T &&, Where const &) {
+        this->stamp();
+    }
+};
+
+
+// Where the value was constructed and last assigned.  With Enabled false
+// nothing is stored, and the locations read back as null codeplaces.
+
+template <class Place, bool Enabled>
+class tracked_locations
+{
+public:
+    explicit tracked_locations (codeplace const & cp) :
         _constructLocation (cp),
         _lastAssignLocation (cp)
     {
     }
 
+    codeplace constructed () const {
+        return _constructLocation;
+    }
+
+    codeplace lastAssigned () const {
+        return _lastAssignLocation;
+    }
+
+    Place const & lastAssignedPlace () const {
+        return _lastAssignLocation;
+    }
+
+    void assigned (codeplace const & cp) {
+        _lastAssignLocation = Place (cp);
+    }
+
+private:
+    Place _constructLocation;
+    Place _lastAssignLocation;
+};
+
+
+struct no_place {
+};
+
+template <class Place>
+class tracked_locations<Place, false>
+{
+public:
+    explicit tracked_locations (codeplace const &) {
+    }
+
+    codeplace constructed () const {
+        return codeplace ();
+    }
+
+    codeplace lastAssigned () const {
+        return codeplace ();
+    }
+
+    no_place lastAssignedPlace () const {
+        return no_place ();
+    }
+
+    void assigned (codeplace const &) {
+    }
+};
+
+
+
+// The set checks take their values followed by a codeplace or a codesite,
+// as in hopefullyInSet(a, b, c, HERE).  These walk such an argument list;
+// the overloads taking a place end the recursion.  AnyEqual also takes a
+// list with no place at the end, for the sets that are template arguments.
+
+template <typename V>
+inline bool AnyEqual (V const &) {
+    return false;
+}
+
+template <typename V>
+inline bool AnyEqual (V const &, codeplace const &) {
+    return false;
+}
+
+template <typename V>
+inline bool AnyEqual (V const &, codesite const &) {
+    return false;
+}
+
+template <typename V, typename A, typename... Rest>
+inline bool AnyEqual (V const & value, A const & a, Rest const &... rest) {
+    // | and not ||, so integral compares come out without branches
+    return (value == a) | AnyEqual(value, rest...);
+}
+
+
+template <typename A, typename... Rest>
+struct last_arg {
+    typedef typename last_arg<Rest...>::type type;
+};
+
+template <typename A>
+struct last_arg<A> {
+    typedef A type;
+};
+
+template <typename A>
+inline A const & LastArg (A const & last) {
+    return last;
+}
+
+template <typename A, typename B, typename... Rest>
+inline typename last_arg<B, Rest...>::type const & LastArg (
+    A const &,
+    B const & next,
+    Rest const &... rest
+) {
+    return LastArg(next, rest...);
+}
+
+
+// Compile-time sets of integral or enum constants, as a bitmask relative
+// to the smallest one when they span fewer than 64 values
+
+template <typename T, typename = void>
+struct set_constant {
+    typedef int type; // placeholder; hopefullyInSetOf() asserts on it
+};
+
+template <typename T>
+struct set_constant<
+    T,
+    typename std::enable_if<
+        std::is_integral<T>::value or std::is_enum<T>::value
+    >::type
+> {
+    typedef T type;
+};
+
+constexpr long long SetMin (long long a) {
+    return a;
+}
+
+template <typename... Rest>
+constexpr long long SetMin (long long a, Rest... rest) {
+    return a < SetMin(rest...) ? a : SetMin(rest...);
+}
+
+constexpr long long SetMax (long long a) {
+    return a;
+}
+
+template <typename... Rest>
+constexpr long long SetMax (long long a, Rest... rest) {
+    return a > SetMax(rest...) ? a : SetMax(rest...);
+}
+
+constexpr unsigned long long SetMask (long long) {
+    return 0;
+}
+
+template <typename... Rest>
+constexpr unsigned long long SetMask (
+    long long low,
+    long long a,
+    Rest... rest
+) {
+    return (a - low < 64 ? 1ULL << (a - low) : 0) | SetMask(low, rest...);
+}
+
+} // end namespace detail
+
+
+// Building with HOIST_NO_TRACKING defined compiles the locations and the
+// history out of every tracked, leaving just the value.  The interface is
+// the same: the checks still run and still report through hopefully, but
+// whereConstructed() and whereLastAssigned() give null codeplaces.
+
+#ifdef HOIST_NO_TRACKING
+    #define HOIST_TRACKING 0
+#else
+    #define HOIST_TRACKING 1
+#endif
+
+
+// The locations are kept as codeplaces by default.  Use codesite for Place
+// to keep them as 32-bit handles instead, which is much more compact when
+// T is small; whereConstructed() and whereLastAssigned() then cost a lookup
+// in the registry's table of sites.
+//
+// History is how many (value, location) pairs are kept, counting the
+// current one, in a ring inside the object.  With Timestamps each of them
+// also gets the time of the assignment.  The defaults of 1 and false
+// store nothing beyond what tracked always has.  With a longer history
+// T must be default constructible, and the earlier values are shown in
+// the messages of the hopefully methods.
+//
+// There are no virtual methods.  A class that has to know about changes to
+// the value (as mapped does, to keep its manager's copy current) passes
+// itself as Derived, and declares a private onAssigned(codeplace const &)
+// which every assignment calls after the value is stored.  tracked has to
+// be a friend of it to make the call.  With the default of void the hook
+// is empty and inlines away.  Since the destructor isn't virtual either,
+// don't delete a listed, mapped or stacked through a pointer to tracked.
+
+template <
+    class T,
+    class Place = codeplace,
+    size_t History = 1,
+    bool Timestamps = false,
+    class Derived = void
+>
+class tracked
+    : private detail::tracked_locations<Place, HOIST_TRACKING != 0>,
+    private detail::tracked_history<
+        T,
+        Place,
+        HOIST_TRACKING ? History : 1,
+        HOIST_TRACKING and Timestamps
+    >
+{
+    template <class, class, size_t, bool, class>
+    friend class tracked;
+
+    typedef detail::tracked_locations<Place, HOIST_TRACKING != 0>
+        locations_type;
+
+    typedef detail::tracked_history<
+        T,
+        Place,
+        HOIST_TRACKING ? History : 1,
+        HOIST_TRACKING and Timestamps
+    > history_type;
+
+    typedef typename history_type::entry history_entry;
+
+    typedef typename std::conditional<
+        std::is_void<Derived>::value, tracked, Derived
+    >::type derived_type;
+
+public:
+    tracked (T const & value, codeplace const & cp) :
+        locations_type (cp),
+        _value (value)
+    {
+    }
+
     tracked (T && value, codeplace const & cp) :
-        _value (std::move(value)),
-        _constructLocation (cp),
-        _lastAssignLocation (cp)
+        locations_type (cp),
+        _value (std::move(value))
     {
     }
 
@@ -52,15 +474,30 @@ public:
     // REVIEW: There are some extra bits in codeplace at the moment.
     // might it be useful to have a "copy constructed" bit to document
     // this situation?
-    tracked (const tracked<T>& other) :
-        _value (other._value),
-        _constructLocation (other._constructLocation),
-        _lastAssignLocation (other._lastAssignLocation)
+    tracked (tracked const & other) :
+        locations_type (other),
+        history_type (other),
+        _value (other._value)
+    {
+    }
+
+    // Copies out of a listed, mapped or stacked into a plain tracked, which
+    // is how their managers hand values back
+    template <class OtherDerived>
+    tracked (
+        tracked<T, Place, History, Timestamps, OtherDerived> const & other
+    ) :
+        locations_type (other),
+        history_type (other),
+        _value (other._value)
     {
     }
 
-    virtual ~tracked()
-        { }
+    // Watches are on this object, and aren't copied with it
+    ~tracked () {
+        if (Q_UNLIKELY(detail::TrackedWatchesActive()))
+            detail::ForgetTrackedWatches(this);
+    }
 
 public:
     // Basic accessors, the value has an implicit casting operator so it can
@@ -79,91 +516,180 @@ public:
     }
 
 
-    // Tracked types may eventually offer a longer value/location history
-    // Perhaps another parameter to the template for the length?
-
     codeplace whereConstructed () const {
-        return _constructLocation;
+        return locations_type::constructed();
     }
 
     codeplace whereLastAssigned () const {
-        return _lastAssignLocation;
+        return locations_type::lastAssigned();
+    }
+
+
+    // The history, by age: 0 is the current value, and the construction
+    // counts as an assignment.  historySize() is at most History, and is
+    // always 1 when built with HOIST_NO_TRACKING.
+
+    static size_t const historyLength = HOIST_TRACKING ? History : 1;
+
+    size_t historySize () const {
+        return history_type::previousCount() + 1;
+    }
+
+    T const & valueAtAge (size_t const age) const {
+        history_entry const * entry = previousEntry(age);
+        return entry ? entry->value : _value;
+    }
+
+    codeplace whereAssignedAtAge (size_t const age) const {
+        history_entry const * entry = previousEntry(age);
+        return entry
+            ? codeplace (entry->where)
+            : locations_type::lastAssigned();
+    }
+
+    // msecs since the epoch, or 0 without Timestamps
+    qint64 whenAssignedAtAge (size_t const age) const {
+        history_entry const * entry = previousEntry(age);
+        return entry ? entry->when() : history_type::when();
     }
 
 
 public:
-    // Is there a better way to do this that doesn't involve the caller
-    // generating some kind of costly set structure?  Variadic templates?
+    // Any number of values, then the codeplace (or a codesite):
     //
-    // https://github.com/hostilefork/hoist/issues/5
-
-    bool hopefullyInSet (
-        T const & v1, T const & v2, T const & v3, codeplace const & cp
-    )
-        const
-    {
-        const T* goodValues[3] = {&v1, &v2, &v3};
-        return hopefullyInSetCore(static_cast<const T**>(goodValues), 3, cp);
+    //     state.hopefullyInSet(Idle, Connecting, Open, HERE);
+    //
+    // The values are compared in place; nothing is copied or collected
+    // unless the check fails.
+
+    template <typename... Args>
+    bool hopefullyInSet (Args const &... valuesThenPlace) const {
+        static_assert(
+            sizeof...(Args) >= 2, "hopefullyInSet needs values and a codeplace"
+        );
+        if (Q_LIKELY(detail::AnyEqual(_value, valuesThenPlace...)))
+            return true;
+        return inSetFailed(valuesThenPlace...);
     }
 
-    bool hopefullyInSet (
-        T const & v1,
-        T const & v2,
-        codeplace const & cp
-    )
-        const
-    {
-        const T* goodValues[2] = {&v1, &v2};
-        return hopefullyInSetCore(static_cast<const T**>(goodValues), 2, cp);
+    bool hopefullyEqualTo (T const & value, codeplace const & cp) const {
+        if (Q_LIKELY(_value == value))
+            return true;
+        return inSetFailed(value, cp);
     }
 
-    bool hopefullyEqualTo(T const & value, codeplace const & cp) const
-    {
-        const T* goodValues[1] = {&value};
-        return hopefullyInSetCore(static_cast<const T**>(goodValues), 1, cp);
+    // For integral and enum T, with the set as template arguments.  If the
+    // constants span fewer than 64 values this is a shift and a mask.
+    //
+    //     state.hopefullyInSetOf<Idle, Connecting>(HERE);
+
+    template <typename detail::set_constant<T>::type... Values>
+    bool hopefullyInSetOf (codeplace const & cp) const {
+        static_assert(
+            std::is_integral<T>::value or std::is_enum<T>::value,
+            "hopefullyInSetOf needs an integral or enum type"
+        );
+        if (Q_LIKELY(inConstantSet<Values...>()))
+            return true;
+        return inSetFailed(Values..., cp);
     }
 
 public:
-    bool hopefullyNotInSet(
-        T const & v1, T const & v2, T const & v3, codeplace const & cp
-    )
-        const
-    {
-        const T* badValues[3] = {&v1, &v2, &v3};
-        return hopefullyNotInSetCore(static_cast<const T**>(badValues), 3, cp);
+    template <typename... Args>
+    bool hopefullyNotInSet (Args const &... valuesThenPlace) const {
+        static_assert(
+            sizeof...(Args) >= 2,
+            "hopefullyNotInSet needs values and a codeplace"
+        );
+        if (Q_LIKELY(not detail::AnyEqual(_value, valuesThenPlace...)))
+            return true;
+        return notInSetFailed(valuesThenPlace...);
     }
 
-    bool hopefullyNotInSet(
-        T const & v1, T const & v2, codeplace const & cp
-    )
-        const
-    {
-        const T* badValues[2] = {&v1, &v2};
-        return hopefullyNotInSetCore(static_cast<const T**>(badValues), 2, cp);
+    bool hopefullyNotEqualTo (T const & value, codeplace const & cp) const {
+        if (Q_LIKELY(_value != value))
+            return true;
+        return notInSetFailed(value, cp);
     }
 
-    bool hopefullyNotEqualTo(T const & value, codeplace const & cp) const
-    {
-        const T* badValues[1] = {&value};
-        return hopefullyNotInSetCore(static_cast<const T**>(badValues), 1, cp);
+    template <typename detail::set_constant<T>::type... Values>
+    bool hopefullyNotInSetOf (codeplace const & cp) const {
+        static_assert(
+            std::is_integral<T>::value or std::is_enum<T>::value,
+            "hopefullyNotInSetOf needs an integral or enum type"
+        );
+        if (Q_LIKELY(not inConstantSet<Values...>()))
+            return true;
+        return notInSetFailed(Values..., cp);
+    }
+
+
+
+public:
+    // Calls callback(value, cp) after any assignment to this object that
+    // leaves a value for which predicate(value) is true, with the codeplace
+    // of the assignment:
+    //
+    //     auto watch = state.watch(
+    //         [](State s) { return s == Closed; },
+    //         [](State, codeplace const & cp) { qDebug() << cp.toString(); }
+    //     );
+    //
+    // This covers assign(), and guarantee() or the hopefully methods when
+    // they assign.  The callback runs on the assigning thread, after the
+    // assignment, and may add or cancel watches.  A watch that is cancelled
+    // while another thread is assigning may still see that one assignment.
+    //
+    // While no tracked anywhere is being watched, the cost to assign() is
+    // one load and a branch that predicts not taken.  While some are, the
+    // others pay for a lookup by address under a shared lock when they
+    // are assigned or destroyed.
+
+    template <typename Predicate, typename Callback>
+    tracked_watch watch (Predicate predicate, Callback callback) {
+        return tracked_watch (detail::AddTrackedWatch(
+            this,
+            [predicate, callback](void const * value, codeplace const & cp) {
+                T const & current = *static_cast<T const *>(value);
+                if (predicate(current))
+                    callback(current, cp);
+            }
+        ));
     }
 
+    // When the value becomes (or is assigned again as) target
+    template <typename Callback>
+    tracked_watch watchFor (T const & target, Callback callback) {
+        return watch(
+            [target](T const & value) { return value == target; },
+            callback
+        );
+    }
 
 
 //
 // Operations for setting the value
 //
 public:
-    virtual void assign (T const & newValue, codeplace const & cp)
+    // newValue may be this tracked's own value, or one of its history's
+    // (as in t.assign(t.valueAtAge(1), HERE)), and the push moves from the
+    // one and overwrites the other.  So it is taken out first.
+
+    void assign (T const & newValue, codeplace const & cp)
     {
-        _value = newValue;
-        _lastAssignLocation = cp;
+        assignCopy(
+            newValue, cp, std::integral_constant<bool, historyLength != 1> ()
+        );
     }
 
-    virtual void assign (T && newValue, codeplace const & cp)
+    void assign (T && newValue, codeplace const & cp)
     {
-        _value = std::move(newValue);
-        _lastAssignLocation = cp;
+        T value (std::move(newValue));
+        history_type::push(
+            std::move(_value), locations_type::lastAssignedPlace()
+        );
+        _value = std::move(value);
+        finishAssign(cp);
     }
 
     void guarantee (T const & newValue, codeplace const & cp)
@@ -211,82 +737,168 @@ public:
 
 
 protected:
-    bool hopefullyInSetCore (
-        T const * * goodValues,
-        size_t const & numGoodValues,
-        codeplace const & cp
+    // What a Derived without its own onAssigned() gets
+    void onAssigned (codeplace const &) {
+    }
+
+private:
+    void assignCopy (
+        T const & newValue,
+        codeplace const & cp,
+        std::true_type
+    ) {
+        T value (newValue);
+        assign(std::move(value), cp);
+    }
+
+    // Without a history the push keeps nothing, and the only value newValue
+    // can be is _value itself, which copy assignment has to handle anyway
+    void assignCopy (
+        T const & newValue,
+        codeplace const & cp,
+        std::false_type
+    ) {
+        history_type::push(
+            std::move(_value), locations_type::lastAssignedPlace()
+        );
+        _value = newValue;
+        finishAssign(cp);
+    }
+
+    // What follows every change of the value
+    void finishAssign (codeplace const & cp) {
+        locations_type::assigned(cp);
+        static_cast<derived_type *>(this)->onAssigned(cp);
+        notifyWatches(cp);
+    }
+
+    void notifyWatches (codeplace const & cp) const {
+        if (Q_UNLIKELY(detail::TrackedWatchesActive()))
+            detail::NotifyTrackedWatches(this, &_value, cp);
+    }
+
+    // The entry for an age of 1 or more.  Without a history there is none,
+    // and any age but 0 is out of range; it reads back as the current one.
+    history_entry const * previousEntry (size_t const age) const {
+        return previousEntry(
+            age, std::integral_constant<bool, historyLength != 1> ()
+        );
+    }
+
+    history_entry const * previousEntry (
+        size_t const age,
+        std::true_type
+    )
+        const
+    {
+        return age == 0 ? nullptr : &history_type::previous(age);
+    }
+
+    history_entry const * previousEntry (
+        size_t const age,
+        std::false_type
     )
         const
     {
-        hopefully(numGoodValues != 0, HERE);
+        assert(age == 0);
+        Q_UNUSED(age);
+        return nullptr;
+    }
 
-        for (size_t index = 0; index < numGoodValues; index++) {
-            if (_value == *(goodValues[index]))
-                return true;
+    template <typename detail::set_constant<T>::type... Values>
+    bool inConstantSet () const {
+        constexpr long long low = detail::SetMin(
+            static_cast<long long>(Values)...
+        );
+        constexpr long long high = detail::SetMax(
+            static_cast<long long>(Values)...
+        );
+        constexpr unsigned long long mask = detail::SetMask(
+            low, static_cast<long long>(Values)...
+        );
+
+        if (high - low < 64) {
+            unsigned long long const offset = static_cast<unsigned long long>(
+                static_cast<long long>(_value) - low
+            );
+            return offset < 64 and ((mask >> offset) & 1) != 0;
         }
+        return detail::AnyEqual(_value, Values...);
+    }
+
+    void writeValues (QTextStream &, bool const, codeplace const &) const {
+    }
+
+    void writeValues (QTextStream &, bool const, codesite const &) const {
+    }
+
+    template <typename... Rest>
+    void writeValues (
+        QTextStream & ts,
+        bool const first,
+        T const & value,
+        Rest const &... rest
+    )
+        const
+    {
+        if (not first)
+            ts << ",";
+        ts << value;
+        writeValues(ts, false, rest...);
+    }
 
+    template <typename... Args>
+    HOIST_COLD bool inSetFailed (Args const &... valuesThenPlace) const {
         QString message;
         QTextStream ts (&message);
-        if (numGoodValues == 1) {
-            ts << "Expected value to be " << *(goodValues[0]);
+        if (sizeof...(Args) == 2) {
+            ts << "Expected value to be ";
+            writeValues(ts, true, valuesThenPlace...);
         } else {
             ts << "Expected value to be in set [";
-            for(size_t index = 0; index < numGoodValues; index++) {
-                ts << *(goodValues[index]);
-                if (index == numGoodValues - 1)
-                    ts << "] ";
-                else
-                    ts << ",";
-            }
+            writeValues(ts, true, valuesThenPlace...);
+            ts << "] ";
         }
-        ts << " and it was " << _value << endl;
-        ts <<"Last assignment was at " << _lastAssignLocation.toString();
-        hopefullyNotReached(message, cp);
+        ts << " and it was " << _value;
+        if (HOIST_TRACKING)
+            ts << endl << "Last assignment was at " << whereLastAssigned();
+        writeHistory(ts);
+        hopefullyNotReached(message, detail::LastArg(valuesThenPlace...));
         return false;
     }
 
-    bool hopefullyNotInSetCore (
-        T const * * badValues,
-        size_t const & numBadValues,
-        codeplace const & cp
-    )
-        const
-    {
-        hopefully(numBadValues != 0, HERE);
-
-        for (size_t index = 0; index < numBadValues; index++) {
-            if (_value == *(badValues[index])) {
-
-                QString message;
-                QTextStream ts (&message);
-                if (numBadValues == 1) {
-                    ts << "Didn't expect value to be "
-                        << *badValues[0]
-                        << '\n';
-                } else {
-                    ts << "Didn't expect value to be in set [";
-                    for (size_t index = 0; index < numBadValues; index++) {
-                        ts << *(badValues[index]);
-                        if (index == numBadValues - 1)
-                            ts << "] ";
-                        else
-                            ts << ",";
-                    }
-                    ts << " and it was " << _value << '\n';
-                }
-                ts <<"Last assignment at " << _lastAssignLocation.toString();
-                hopefullyNotReached(message, cp);
-                return false;
-            }
+    template <typename... Args>
+    HOIST_COLD bool notInSetFailed (Args const &... valuesThenPlace) const {
+        QString message;
+        QTextStream ts (&message);
+        if (sizeof...(Args) == 2) {
+            ts << "Didn't expect value to be ";
+            writeValues(ts, true, valuesThenPlace...);
+            ts << '\n';
+        } else {
+            ts << "Didn't expect value to be in set [";
+            writeValues(ts, true, valuesThenPlace...);
+            ts << "] ";
+            ts << " and it was " << _value << '\n';
         }
+        if (HOIST_TRACKING)
+            ts << "Last assignment at " << whereLastAssigned();
+        writeHistory(ts);
+        hopefullyNotReached(message, detail::LastArg(valuesThenPlace...));
+        return false;
+    }
 
-        return true;
+    void writeHistory (QTextStream & ts) const {
+        for (size_t age = 1; age < historySize(); age++) {
+            ts << endl << "Before that it was " << valueAtAge(age)
+                << " from " << whereAssignedAtAge(age);
+            if (Timestamps)
+                ts << " at " << whenAssignedAtAge(age) << " msecs";
+        }
     }
 
 private:
     T _value;
-    codeplace _constructLocation;
-    codeplace _lastAssignLocation;
 };
 
 } // end namespace hoist
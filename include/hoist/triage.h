@@ -0,0 +1,130 @@
+//
+//  triage.h - A local triage database for hopes, kept in a memory-mapped
+//      file keyed by codeplace uuid.  It counts how often each site has
+//      failed, when it was first and last seen and what it last said, and
+//      holds a disposition for the site: whether a failure there should be
+//      ignored, logged or treated as fatal.  onHopeFailedTriage is a
+//      hope_failed_handler that answers from it.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_TRIAGE_H
+#define HOIST_TRIAGE_H
+
+#include "codeplace.h"
+
+#include <QString>
+#include <QFile>
+
+namespace hoist {
+
+// Default means the site hasn't been given one, so the database's default
+// applies.  The numbers are stored in the file, so don't reorder these.
+
+enum class triage_disposition : uint32_t {
+    Default = 0,
+    Ignore = 1,
+    Log = 2,
+    Fatal = 3
+};
+
+
+//
+// The records are updated with atomic operations directly in the shared
+// mapping.  If the process dies, the kernel still has every update that
+// was made, and a record that was caught half-written is repaired when the
+// file is next opened.  (Surviving the machine going down would need an
+// msync, which is left to the caller's judgment of how often to pay it.)
+//
+// The table is a fixed size chosen when the file is created.  Once it is
+// full, new sites get the default disposition and are not recorded.
+//
+
+class triage_database final
+{
+    Q_DISABLE_COPY(triage_database)
+
+public:
+    struct entry
+    {
+        uuid128 uuid;
+        uint64_t count;
+        qint64 firstSeenMsecs; // since the epoch
+        qint64 lastSeenMsecs;
+        triage_disposition disposition;
+        QString lastMessage; // cut off at a fixed length
+    };
+
+public:
+    // capacity is only used when the file is created, and is rounded up
+    // to a power of two
+    explicit triage_database (
+        QString const & path,
+        triage_disposition defaultDisposition = triage_disposition::Fatal,
+        size_t capacity = 4096
+    );
+
+    ~triage_database ();
+
+public:
+    bool isValid () const;
+
+    size_t capacity () const;
+
+    // Counts occurrences and says what to do about them.  The message is
+    // not stored for sites that are ignored, to keep those cheap.
+    triage_disposition record (
+        codeplace const & cp,
+        QString const & message,
+        uint64_t occurrences = 1
+    );
+
+    // What a failure at the site should get, with the default resolved
+    triage_disposition disposition (uuid128 const & uuid) const;
+
+    // Makes a record for the site if there isn't one; false if it's full
+    bool setDisposition (
+        uuid128 const & uuid,
+        triage_disposition const & disposition
+    );
+
+    bool lookup (uuid128 const & uuid, entry & result) const;
+
+private:
+    struct record_type;
+
+    record_type * find (uuid128 const & uuid, bool const create) const;
+
+private:
+    QFile _file;
+    uchar * _data;
+    size_t _capacity;
+    triage_disposition const _defaultDisposition;
+};
+
+
+// Until a database is given, onHopeFailedTriage acts like onHopeFailedBasic.
+// The caller keeps ownership, and must set null before destroying it.
+//
+// The handler may hear about only some failures (see setHopeFailedLimits),
+// so it records the site's exact count from hopeFailedCount(): each call
+// adds the failures since the previous call for the site.
+//
+// With startHopeFailedThread() the handler runs on the delivery thread, so
+// a Fatal disposition halts the program from there, after the failing
+// thread has carried on.  To halt on the failing thread, install it on
+// that thread with a scoped_hope_failed_handler, which bypasses the queue.
+
+void setHopeFailedTriageDatabase (triage_database * database);
+
+void onHopeFailedTriage (QString const & message, codeplace const & cp);
+
+} // end namespace hoist
+
+#endif
@@ -0,0 +1,408 @@
+//
+//  uuid128.h - A literal type holding the 128 bits of a codeplace's
+//     identity, along with constexpr machinery that lets the compiler
+//     calculate the hashed identity of a HERE codeplace and decode the
+//     base64 identity of a PLACE codeplace, so that neither has to be
+//     done at runtime.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#ifndef HOIST_UUID128_H
+#define HOIST_UUID128_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hoist {
+
+//
+// The bits are kept in the order that QDataStream uses when it serializes
+// a QUuid (big-endian fields).  So "high" holds data1, data2 and data3 while
+// "low" holds the eight bytes of data4.  Two integers are used instead of a
+// QUuid because QUuid cannot be relied upon to be a literal type.
+//
+
+struct uuid128 final
+{
+    uint64_t high;
+    uint64_t low;
+
+    constexpr uuid128 () :
+        high (0),
+        low (0)
+    {
+    }
+
+    constexpr uuid128 (uint64_t const high, uint64_t const low) :
+        high (high),
+        low (low)
+    {
+    }
+
+    constexpr bool isNull () const {
+        return (high == 0) and (low == 0);
+    }
+
+    constexpr bool operator== (uuid128 const & rhs) const {
+        return (high == rhs.high) and (low == rhs.low);
+    }
+
+    constexpr bool operator!= (uuid128 const & rhs) const {
+        return not (*this == rhs);
+    }
+};
+
+
+//
+// Runtime base64 codec for uuid128, for when ids are exported or imported
+// in bulk.  The text form is always exactly Base64UuidLength characters in
+// the caller's buffer: no "==" padding and no terminator.  Decoding is
+// table-driven and branch-free, and a character outside the base64
+// alphabet makes the result a null uuid128.  The batch versions work on
+// packed arrays, 22 characters per id, and decoding returns how many ids
+// were malformed.
+//
+
+size_t const Base64UuidLength = 22;
+
+void Base64CharsFromUuid128 (
+    uuid128 const & uuid,
+    char (& chars)[Base64UuidLength]
+);
+
+bool Uuid128FromBase64Chars (
+    char const (& chars)[Base64UuidLength],
+    uuid128 & uuid
+);
+
+void Base64CharsFromUuid128s (
+    uuid128 const * uuids,
+    size_t const count,
+    char * chars
+);
+
+size_t Uuid128sFromBase64Chars (
+    char const * chars,
+    size_t const count,
+    uuid128 * uuids
+);
+
+// Decodes the first 22 characters of a terminated string, ignoring what
+// comes after (such as "==" padding)
+uuid128 Uuid128FromBase64String (char const * str);
+
+
+namespace detail {
+
+//
+// MD4 (RFC 1320) written in the single-return-statement style required
+// by C++11 constexpr.  This is what QCryptographicHash::Md4 calculates, so
+// a HERE evaluated by the compiler has the same uuid as one which is
+// hashed at runtime.  It is not fast when run at runtime and should only
+// be used where the compiler is forced to evaluate it.
+//
+
+struct md4_state final
+{
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+
+    constexpr md4_state (
+        uint32_t const a,
+        uint32_t const b,
+        uint32_t const c,
+        uint32_t const d
+    ) :
+        a (a), b (b), c (c), d (d)
+    {
+    }
+
+    constexpr uint32_t at (int const i) const {
+        return i == 0 ? a : i == 1 ? b : i == 2 ? c : d;
+    }
+
+    constexpr md4_state with (int const i, uint32_t const value) const {
+        return i == 0 ? md4_state (value, b, c, d)
+            : i == 1 ? md4_state (a, value, c, d)
+            : i == 2 ? md4_state (a, b, value, d)
+            : md4_state (a, b, c, value);
+    }
+
+    constexpr md4_state plus (md4_state const & other) const {
+        return md4_state (
+            static_cast<uint32_t>(a + other.a),
+            static_cast<uint32_t>(b + other.b),
+            static_cast<uint32_t>(c + other.c),
+            static_cast<uint32_t>(d + other.d)
+        );
+    }
+};
+
+
+constexpr int DecimalDigitCount (unsigned long const n) {
+    return n < 10 ? 1 : 1 + DecimalDigitCount(n / 10);
+}
+
+constexpr unsigned long PowerOfTen (int const exponent) {
+    return exponent == 0 ? 1 : 10 * PowerOfTen(exponent - 1);
+}
+
+
+// The hashed message is the decimal line number followed by the filename,
+// matching the string codeplace hands to QCryptographicHash at runtime.
+
+struct here_message final
+{
+    char const * filename;
+    size_t filenameLength;
+    unsigned long line;
+    size_t lineDigits;
+
+    constexpr here_message (
+        char const * filename,
+        size_t const filenameLength,
+        unsigned long const line
+    ) :
+        filename (filename),
+        filenameLength (filenameLength),
+        line (line),
+        lineDigits (static_cast<size_t>(DecimalDigitCount(line)))
+    {
+    }
+
+    constexpr size_t length () const {
+        return lineDigits + filenameLength;
+    }
+
+    // room for the 0x80 terminator and the 64-bit length, block-aligned
+    constexpr size_t paddedLength () const {
+        return ((length() + 8) / 64 + 1) * 64;
+    }
+
+    constexpr uint8_t byteAt (size_t const i) const {
+        return i < lineDigits
+            ? static_cast<uint8_t>(
+                '0' + (line / PowerOfTen(
+                    static_cast<int>(lineDigits - 1 - i)
+                )) % 10
+            )
+            : i < length()
+            ? static_cast<uint8_t>(filename[i - lineDigits])
+            : i == length()
+            ? static_cast<uint8_t>(0x80)
+            : i < paddedLength() - 8
+            ? static_cast<uint8_t>(0)
+            : static_cast<uint8_t>(
+                (static_cast<uint64_t>(length()) * 8)
+                >> (8 * (i - (paddedLength() - 8)))
+            );
+    }
+
+    constexpr uint32_t wordAt (size_t const block, int const k) const {
+        return static_cast<uint32_t>(byteAt(block * 64 + k * 4))
+            | static_cast<uint32_t>(byteAt(block * 64 + k * 4 + 1)) << 8
+            | static_cast<uint32_t>(byteAt(block * 64 + k * 4 + 2)) << 16
+            | static_cast<uint32_t>(byteAt(block * 64 + k * 4 + 3)) << 24;
+    }
+};
+
+
+constexpr uint32_t Md4RotateLeft (uint32_t const x, int const s) {
+    return static_cast<uint32_t>((x << s) | (x >> (32 - s)));
+}
+
+// Which of the 16 message words is mixed in at each of the 48 steps
+constexpr int Md4WordIndex (int const step) {
+    return step < 16 ? step
+        : step < 32 ? ((step - 16) % 4) * 4 + (step - 16) / 4
+        : (((step - 32) & 1) << 3) | (((step - 32) & 2) << 1)
+            | (((step - 32) & 4) >> 1) | (((step - 32) & 8) >> 3);
+}
+
+constexpr int Md4Shift (int const step) {
+    return step < 16
+        ? (step % 4 == 0 ? 3 : step % 4 == 1 ? 7 : step % 4 == 2 ? 11 : 19)
+        : step < 32
+        ? (step % 4 == 0 ? 3 : step % 4 == 1 ? 5 : step % 4 == 2 ? 9 : 13)
+        : (step % 4 == 0 ? 3 : step % 4 == 1 ? 9 : step % 4 == 2 ? 11 : 15);
+}
+
+constexpr uint32_t Md4Mix (
+    int const step,
+    uint32_t const x,
+    uint32_t const y,
+    uint32_t const z
+) {
+    return step < 16
+        ? static_cast<uint32_t>((x & y) | (~x & z))
+        : step < 32
+        ? static_cast<uint32_t>(((x & y) | (x & z) | (y & z)) + 0x5A827999)
+        : static_cast<uint32_t>((x ^ y ^ z) + 0x6ED9EBA1);
+}
+
+// The register updated rotates a, d, c, b and the mix reads the other three
+// in order, e.g. step 1 is "d = (d + F(a, b, c) + X[1]) <<< 7"
+constexpr md4_state Md4StepOnRegister (
+    md4_state const & s,
+    here_message const & m,
+    size_t const block,
+    int const step,
+    int const r
+) {
+    return s.with(r, Md4RotateLeft(
+        static_cast<uint32_t>(
+            s.at(r)
+            + Md4Mix(
+                step,
+                s.at((r + 1) % 4),
+                s.at((r + 2) % 4),
+                s.at((r + 3) % 4)
+            )
+            + m.wordAt(block, Md4WordIndex(step))
+        ),
+        Md4Shift(step)
+    ));
+}
+
+constexpr md4_state Md4Steps (
+    md4_state const & s,
+    here_message const & m,
+    size_t const block,
+    int const step
+) {
+    return step == 48 ? s : Md4Steps(
+        Md4StepOnRegister(s, m, block, step, (4 - step % 4) % 4),
+        m,
+        block,
+        step + 1
+    );
+}
+
+constexpr md4_state Md4Blocks (
+    md4_state const & s,
+    here_message const & m,
+    size_t const block
+) {
+    return block == m.paddedLength() / 64 ? s : Md4Blocks(
+        s.plus(Md4Steps(s, m, block, 0)), m, block + 1
+    );
+}
+
+constexpr uint32_t ByteSwap32 (uint32_t const x) {
+    return static_cast<uint32_t>(
+        ((x & 0x000000FFu) << 24) | ((x & 0x0000FF00u) << 8)
+        | ((x & 0x00FF0000u) >> 8) | ((x & 0xFF000000u) >> 24)
+    );
+}
+
+// MD4 digest bytes are the little-endian words a, b, c, d in sequence
+constexpr uuid128 Uuid128FromMd4State (md4_state const & s) {
+    return uuid128 (
+        (static_cast<uint64_t>(ByteSwap32(s.a)) << 32) | ByteSwap32(s.b),
+        (static_cast<uint64_t>(ByteSwap32(s.c)) << 32) | ByteSwap32(s.d)
+    );
+}
+
+
+//
+// Base64 decoding of the 22 significant characters of a uuid, in the same
+// single-return-statement style.  The 128 bits are followed by 4 bits of
+// zero padding in the last character.
+//
+
+constexpr int Base64Sextet (char const c) {
+    return (c >= 'A' and c <= 'Z') ? c - 'A'
+        : (c >= 'a' and c <= 'z') ? c - 'a' + 26
+        : (c >= '0' and c <= '9') ? c - '0' + 52
+        : c == '+' ? 62
+        : c == '/' ? 63
+        : -1;
+}
+
+constexpr bool IsBase64UuidChars (char const * str, size_t const i) {
+    return i == 22 or (
+        Base64Sextet(str[i]) >= 0 and IsBase64UuidChars(str, i + 1)
+    );
+}
+
+// The part of character i's six bits that land in the given 64-bit word,
+// where "start" is the character's bit offset from the top of that word
+constexpr uint64_t Base64BitsInWord (uint64_t const sextet, int const start) {
+    return (start <= -6 or start >= 64) ? 0
+        : start < 0
+        ? (sextet & ((uint64_t(1) << (6 + start)) - 1)) << (58 - start)
+        : start > 58
+        ? sextet >> (start - 58)
+        : sextet << (58 - start);
+}
+
+constexpr uint64_t Base64Word (
+    char const * str,
+    int const word,
+    int const i
+) {
+    return i == 22 ? 0
+        : Base64BitsInWord(
+            static_cast<uint64_t>(Base64Sextet(str[i])), 6 * i - 64 * word
+        ) | Base64Word(str, word, i + 1);
+}
+
+} // end namespace detail
+
+
+//
+// Identity of a HERE codeplace; this is only constexpr for a string literal
+// filename, and the HERE macro forces the evaluation into a constexpr
+// variable so that the compiler does the work.
+//
+
+template <size_t N>
+constexpr uuid128 Uuid128FromFileAndLine (
+    char const (& filename)[N],
+    long const line
+) {
+    return detail::Uuid128FromMd4State(detail::Md4Blocks(
+        detail::md4_state (0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476),
+        detail::here_message (
+            filename, N - 1, static_cast<unsigned long>(line)
+        ),
+        0
+    ));
+}
+
+
+
+//
+// Check of a PLACE literal, for use in a static_assert: it must be the 22
+// characters of a base64 uuid (optionally followed by "=="), and the
+// padding bits in the last character must be zero.  A typo will thus stop
+// the build instead of producing a null uuid at runtime.
+//
+
+template <size_t N>
+constexpr bool IsBase64Uuid (char const (& str)[N]) {
+    return (N == 23 or (N == 25 and str[22] == '=' and str[23] == '='))
+        and detail::IsBase64UuidChars(str, 0)
+        and (detail::Base64Sextet(str[21]) & 0xF) == 0;
+}
+
+
+template <size_t N>
+constexpr uuid128 Uuid128FromBase64 (char const (& str)[N]) {
+    return uuid128 (
+        detail::Base64Word(str, 0, 0),
+        detail::Base64Word(str, 1, 0)
+    );
+}
+
+} // end namespace hoist
+
+#endif
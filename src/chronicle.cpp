@@ -24,9 +24,19 @@ QDebug chronicleCore (
 ) {
     Q_UNUSED(whereEnableConstructed);
 
+    char output[codeplace::FormatBufferSize];
+    cpOutput.format(output);
+
+    // null when tracked is built with HOIST_NO_TRACKING
+    if (whereEnableLastAssigned.isNull())
+        return qDebug() << "debug output from:" << output << endl;
+
+    char enabler[codeplace::FormatBufferSize];
+    whereEnableLastAssigned.format(enabler);
+
     return qDebug()
-        << "debug output from:" << cpOutput.toString() << endl
-        << "output enabled by:" << whereEnableLastAssigned.toString() << endl;
+        << "debug output from:" << output << endl
+        << "output enabled by:" << enabler << endl;
 }
 
 
@@ -62,4 +72,36 @@ bool chronicle (
 }
 
 
+bool chronicle (
+    tracked<bool, codesite> const & enabled,
+    QString const & message,
+    codeplace const & cp
+) {
+    if (enabled) {
+        chronicleCore(
+            enabled.whereConstructed(),
+            enabled.whereLastAssigned(),
+            cp
+        ) << message << endl;
+    }
+    return enabled;
+}
+
+
+bool chronicle (
+    tracked<bool, codesite> const & enabled,
+    chronicle_function function,
+    codeplace const & cp
+) {
+    if (enabled) {
+        function(chronicleCore(
+            enabled.whereConstructed(),
+            enabled.whereLastAssigned(),
+            cp
+        ));
+    }
+    return enabled;
+}
+
+
 } // end namespace hoist
@@ -14,20 +14,43 @@
 
 #include <QTextStream>
 #include <QDataStream>
+#include <QAtomicInt>
+#include <QHash>
+#include <QReadWriteLock>
+#include <cstring>
+#include <atomic>
+#include <new>
+#include <thread>
 
 namespace hoist {
 
+// These used to go through a QDataStream into a QByteArray and then through
+// Qt's base64, with an assert that decoded the result again.  They now use
+// the fixed-width codec from uuid128.h on stack buffers.
+
 QByteArray Base64StringFromUuid(QUuid const & uuid) {
-    QByteArray buf;
-    QDataStream ds (&buf, QIODevice::WriteOnly);
-    ds << uuid;
-    QByteArray result = buf.toBase64();
-    assert(UuidFromBase64String(result) == uuid);
+    char chars[Base64UuidLength];
+    Base64CharsFromUuid128(Uuid128FromUuid(uuid), chars);
+
+    // Keep the "==" padding that QByteArray::toBase64 used to put on
+    QByteArray result (Base64UuidLength + 2, '=');
+    memcpy(result.data(), chars, Base64UuidLength);
     return result;
 }
 
 
 QUuid UuidFromBase64String(QByteArray const & str) {
+    if (str.size() >= static_cast<int>(Base64UuidLength)) {
+        char chars[Base64UuidLength];
+        memcpy(chars, str.constData(), Base64UuidLength);
+
+        uuid128 bits;
+        if (Uuid128FromBase64Chars(chars, bits))
+            return UuidFrom128Bits(bits);
+    }
+
+    // Qt's decoder is lenient about things like embedded whitespace, so
+    // anything that isn't the plain 22 characters still goes through it
     QByteArray buf = QByteArray::fromBase64(str);
     QDataStream ds (&buf, QIODevice::ReadOnly);
     QUuid uuid;
@@ -38,26 +61,441 @@ QUuid UuidFromBase64String(QByteArray const & str) {
 
 QUuid UuidFrom128Bits(QByteArray const & bytes) {
     assert(bytes.length() == 128/8);
-    // why does datastream need a mutable byte array pointer in R/O mode? :(
-    QDataStream ds (const_cast<QByteArray *>(&bytes), QIODevice::ReadOnly);
-    QUuid uuid;
-    ds >> uuid;
-    return uuid;
+
+    uint64_t words[2] = {0, 0};
+    for (int index = 0; index < 16; index++) {
+        words[index / 8] = (words[index / 8] << 8)
+            | static_cast<uint8_t>(bytes.constData()[index]);
+    }
+    return UuidFrom128Bits(uuid128 (words[0], words[1]));
+}
+
+
+QUuid UuidFrom128Bits(uuid128 const & bits) {
+    return QUuid (
+        static_cast<uint>(bits.high >> 32),
+        static_cast<ushort>(bits.high >> 16),
+        static_cast<ushort>(bits.high),
+        static_cast<uchar>(bits.low >> 56),
+        static_cast<uchar>(bits.low >> 48),
+        static_cast<uchar>(bits.low >> 40),
+        static_cast<uchar>(bits.low >> 32),
+        static_cast<uchar>(bits.low >> 24),
+        static_cast<uchar>(bits.low >> 16),
+        static_cast<uchar>(bits.low >> 8),
+        static_cast<uchar>(bits.low)
+    );
+}
+
+
+uuid128 Uuid128FromUuid(QUuid const & uuid) {
+    uint64_t low = 0;
+    for (int index = 0; index < 8; index++)
+        low = (low << 8) | uuid.data4[index];
+
+    return uuid128 (
+        (static_cast<uint64_t>(uuid.data1) << 32)
+            | (static_cast<uint64_t>(uuid.data2) << 16)
+            | static_cast<uint64_t>(uuid.data3),
+        low
+    );
+}
+
+
+namespace {
+
+// MD4 of the decimal line number followed by the filename; the compiler
+// calculates the same thing for HERE with Uuid128FromFileAndLine
+
+uuid128 Uuid128FromHashedFileAndLine(QString const & filename, long line) {
+    // TODO: Decide what string format will hash best
+    QString fileAndLine = QString::number(line, 10) + filename;
+
+    QByteArray bytes = QCryptographicHash::hash(
+        fileAndLine.toUtf8(), QCryptographicHash::Md4
+    );
+
+    return Uuid128FromUuid(UuidFrom128Bits(bytes));
+}
+
+
+// Appends to a fixed buffer for format() and formatUuid(), dropping what
+// doesn't fit.  Nothing here allocates, so it is safe to use when reporting
+// a failure that happened because memory ran out.
+
+class format_writer final
+{
+public:
+    format_writer (char * buffer, size_t size) :
+        _buffer (buffer),
+        _size (size),
+        _length (0)
+    {
+    }
+
+    void append (char const * str) {
+        while (*str != '\0' and _length + 1 < _size)
+            _buffer[_length++] = *str++;
+    }
+
+    void appendDecimal (long value) {
+        char digits[24];
+        char * out = digits + sizeof(digits);
+        *--out = '\0';
+
+        // work in unsigned so LONG_MIN can be negated
+        unsigned long magnitude = value < 0
+            ? 0UL - static_cast<unsigned long>(value)
+            : static_cast<unsigned long>(value);
+        do {
+            *--out = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (value < 0)
+            *--out = '-';
+
+        append(out);
+    }
+
+    size_t finish () {
+        if (_size != 0)
+            _buffer[_length] = '\0';
+        return _length;
+    }
+
+private:
+    char * _buffer;
+    size_t const _size;
+    size_t _length;
+};
+
+
+// THERE and YONDER are fed filenames from assert hooks and message handlers
+// that can fire very often, but the set of distinct names is small.  Each
+// one is converted to UTF-8 once and kept forever, so the codeplaces can
+// point at it the way they point at a __FILE__ literal.
+//
+// The table is allocated and never destroyed, so codeplaces that outlive
+// static destruction still have valid filenames.  (It was global lifetime
+// issues like that which got the old codeplace manager removed.)
+
+class filename_intern_table final
+{
+    Q_DISABLE_COPY(filename_intern_table)
+
+public:
+    filename_intern_table () {}
+
+    char const * intern (QString const & filename) {
+        {
+            QReadLocker lock (&_lock);
+            auto iter = _table.find(filename);
+            if (iter != _table.end())
+                return iter.value();
+        }
+
+        QWriteLocker lock (&_lock);
+
+        // someone else may have interned it while we were unlocked
+        auto iter = _table.find(filename);
+        if (iter != _table.end())
+            return iter.value();
+
+        QByteArray utf8 = filename.toUtf8();
+        char * permanent = new char[utf8.size() + 1];
+        memcpy(permanent, utf8.constData(), utf8.size() + 1);
+        _table.insert(filename, permanent);
+        return permanent;
+    }
+
+private:
+    QReadWriteLock _lock;
+    QHash<QString, char const *> _table;
+};
+
+
+char const * InternedFilename(QString const & filename) {
+    // C++11 makes initialization of a function-local static thread-safe
+    static filename_intern_table * table = new filename_intern_table;
+    return table->intern(filename);
+}
+
+
+// The codeplace registry is an append-only open-addressed hash table.  The
+// first table is a static array of trivially constructible slots, so it is
+// zero-initialized before any dynamic initialization runs and there is
+// nothing to destroy at shutdown.  If a run of probes in a table is full,
+// the search moves on to a table twice the size, allocated on demand and
+// never freed.
+//
+// A slot is claimed by a compare-and-swap of its 64-bit key (the folded
+// uuid, never 0), then its fields are written and "published" is set.
+// Readers ignore slots that are claimed but not yet published.  Since slots
+// are never emptied, finding an empty slot in a probe run means the uuid
+// isn't in this table or any later one.
+//
+// Each slot also gets the next index in the table of sites, which is what
+// a codesite holds.  So that a uuid only ever gets one index, a thread that
+// finds its uuid claimed but unpublished waits for the publication.
+
+struct alignas(64) registry_slot
+{
+    std::atomic<uint64_t> key;
+    std::atomic<bool> published;
+    uint64_t high;
+    uint64_t low;
+    char const * filename;
+    long line;
+    codeplace::Options options;
+    uint32_t index;
+
+    // the only part that changes after the slot is published
+    mutable codeplace::site_counters counters;
+};
+
+struct registry_table
+{
+    registry_slot * slots;
+    size_t mask;
+    std::atomic<registry_table *> next;
+};
+
+size_t const registryProbeLimit = 16;
+
+registry_slot registryFirstSlots[1024];
+
+registry_table registryFirstTable = {
+    registryFirstSlots, 1024 - 1, {nullptr}
+};
+
+
+// The table of sites is segmented so that it can grow without moving.  The
+// first segment is static and covers indices below 1024; segment n after
+// that covers [1024 * 2^(n - 1), 1024 * 2^n).  Index 0 is the null site.
+
+typedef std::atomic<registry_slot const *> registry_site;
+
+size_t const registryFirstSiteCount = 1024;
+
+registry_site registryFirstSites[registryFirstSiteCount];
+
+std::atomic<registry_site *> registrySiteSegments[32] = {};
+
+std::atomic<uint32_t> registrySiteCount (0);
+
+
+registry_site * RegistrySite(uint32_t index, bool const allocate) {
+    if (index < registryFirstSiteCount)
+        return &registryFirstSites[index];
+
+    int segment = 1;
+    size_t segmentStart = registryFirstSiteCount;
+    while (index >= segmentStart * 2) {
+        segmentStart *= 2;
+        segment++;
+    }
+
+    registry_site * sites
+        = registrySiteSegments[segment].load(std::memory_order_acquire);
+
+    if (not sites) {
+        if (not allocate)
+            return nullptr;
+
+        // segment n is the same size as everything before it
+        registry_site * fresh = new registry_site[segmentStart]();
+        if (
+            registrySiteSegments[segment].compare_exchange_strong(
+                sites,
+                fresh,
+                std::memory_order_acq_rel,
+                std::memory_order_acquire
+            )
+        ) {
+            sites = fresh;
+        } else {
+            delete [] fresh;
+        }
+    }
+
+    return &sites[index - segmentStart];
+}
+
+
+uint64_t RegistryKey(uuid128 const & uuid) {
+    uint64_t const folded = uuid.high ^ uuid.low;
+    return folded == 0 ? 1 : folded;
+}
+
+
+// A filename of null matches any site with the uuid
+
+bool RegistryMatches(
+    registry_slot const & slot,
+    uuid128 const & uuid,
+    char const * filename,
+    long line
+) {
+    if (slot.high != uuid.high or slot.low != uuid.low)
+        return false;
+    if (not filename)
+        return true;
+    return slot.line == line and (
+        slot.filename == filename or strcmp(slot.filename, filename) == 0
+    );
+}
+
+
+registry_slot const * RegistryFind(
+    uuid128 const & uuid,
+    char const * filename = nullptr,
+    long line = 0
+) {
+    uint64_t const key = RegistryKey(uuid);
+
+    registry_table const * table = &registryFirstTable;
+    while (table) {
+        for (size_t probe = 0; probe < registryProbeLimit; probe++) {
+            registry_slot const & slot
+                = table->slots[(key + probe) & table->mask];
+
+            uint64_t const slotKey = slot.key.load(std::memory_order_acquire);
+            if (slotKey == 0)
+                return nullptr;
+
+            if (
+                slotKey == key
+                and slot.published.load(std::memory_order_acquire)
+                and RegistryMatches(slot, uuid, filename, line)
+            ) {
+                return &slot;
+            }
+        }
+        table = table->next.load(std::memory_order_acquire);
+    }
+    return nullptr;
 }
 
 
+registry_table * RegistryNextTable(registry_table * table) {
+    registry_table * next = table->next.load(std::memory_order_acquire);
+    if (next)
+        return next;
+
+    // operator new isn't obliged to honor alignas(64) before C++17
+    size_t const capacity = (table->mask + 1) * 2;
+    registry_slot * slots = static_cast<registry_slot *>(qMallocAligned(
+        capacity * sizeof(registry_slot), alignof(registry_slot)
+    ));
+    for (size_t index = 0; index < capacity; index++)
+        new (&slots[index]) registry_slot ();
+
+    registry_table * fresh = new registry_table {
+        slots, capacity - 1, {nullptr}
+    };
+
+    if (
+        table->next.compare_exchange_strong(
+            next, fresh, std::memory_order_acq_rel, std::memory_order_acquire
+        )
+    ) {
+        return fresh;
+    }
+
+    // another thread attached a table first; ours was never seen by anyone
+    qFreeAligned(fresh->slots);
+    delete fresh;
+    return next;
+}
+
+
+uint32_t RegistryInsert(
+    uuid128 const & uuid,
+    char const * filename,
+    long line,
+    codeplace::Options options
+) {
+    uint64_t const key = RegistryKey(uuid);
+
+    registry_table * table = &registryFirstTable;
+    while (true) {
+        for (size_t probe = 0; probe < registryProbeLimit; probe++) {
+            registry_slot & slot = table->slots[(key + probe) & table->mask];
+
+            uint64_t slotKey = slot.key.load(std::memory_order_acquire);
+            if (slotKey == 0) {
+                if (
+                    slot.key.compare_exchange_strong(
+                        slotKey,
+                        key,
+                        std::memory_order_acq_rel,
+                        std::memory_order_acquire
+                    )
+                ) {
+                    slot.high = uuid.high;
+                    slot.low = uuid.low;
+                    slot.filename = filename;
+                    slot.line = line;
+                    slot.options = options;
+                    slot.index = registrySiteCount.fetch_add(1) + 1;
+                    RegistrySite(slot.index, true)->store(
+                        &slot, std::memory_order_release
+                    );
+                    slot.published.store(true, std::memory_order_release);
+                    return slot.index;
+                }
+                // lost the race for this slot, slotKey now holds the winner
+            }
+
+            if (slotKey != key)
+                continue;
+
+            // only a handful of stores away from being published
+            while (not slot.published.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+            if (RegistryMatches(slot, uuid, filename, line))
+                return slot.index;
+        }
+        table = RegistryNextTable(table);
+    }
+}
+
+} // end anonymous namespace
+
+
 
 ///
 /// codeplace
 ///
 
+// The QString for a codeplace whose filename isn't in the constant pool.
+// It is never modified once made, so copies on any thread can share it and
+// only the count needs to be atomic.
+
+struct codeplace::shared_filename final
+{
+    QAtomicInt refs;
+    QString const filename;
+    QByteArray const filenameUtf8; // so format() needn't convert each time
+
+    explicit shared_filename (QString const & filename) :
+        refs (1),
+        filename (filename),
+        filenameUtf8 (filename.toUtf8())
+    {
+    }
+};
+
+
 // I do not like this very much but default constructible is needed for
 // several purposes, including qRegisterMetaType.
 codeplace::codeplace () :
     _options (Options::None),
+    _siteIndex (0),
     _filenameEither (nullptr),
     _line (-1),
-    _uuidEither (nullptr)
+    _uuidBits ()
 {
 }
 
@@ -65,18 +503,30 @@ codeplace::codeplace () :
 // copy constructor is public
 codeplace::codeplace (codeplace const & other) :
     _options (Options::None),
+    _siteIndex (0),
     _filenameEither (nullptr),
     _line (other._line),
-    _uuidEither (nullptr)
+    _uuidBits ()
 {
     transitionFromNull(other);
 }
 
 
+codeplace::codeplace (codeplace && other) noexcept :
+    _options (other._options),
+    _siteIndex (other._siteIndex),
+    _filenameEither (other._filenameEither),
+    _line (other._line),
+    _uuidBits (other._uuidBits)
+{
+    other.clearToNull();
+}
+
+
 codeplace::~codeplace () {
     // Optimization; for some reason transitionToNull is (relatively) slow
     // even if it is a no-op
-    if (_options >= Options::FilenameIsQString)
+    if ((_options & Options::FilenameIsQString) != Options::None)
         transitionToNull();
 }
 
@@ -87,19 +537,26 @@ codeplace & codeplace::operator= (codeplace const & rhs) {
         // free any strings we may have responsibility to free
         transitionToNull();
 
-        // copy and potentially allocate new QStrings
+        // copy, taking a share of any QString filename
         transitionFromNull(rhs);
     }
     return *this;
 }
 
 
-int codeplace::operator== (codeplace const & rhs) const {
-    // Should we allow comparisons of null codeplaces?
+codeplace & codeplace::operator= (codeplace && rhs) noexcept {
+    if (&rhs != this) {
+        transitionToNull();
+
+        _options = rhs._options;
+        _siteIndex = rhs._siteIndex;
+        _filenameEither = rhs._filenameEither;
+        _line = rhs._line;
+        _uuidBits = rhs._uuidBits;
 
-    // TODO: current semantics is uuid equality, is that sensible?
-    // also what to do about null uuids?
-    return this->getUuid() == rhs.getUuid();
+        rhs.clearToNull();
+    }
+    return *this;
 }
 
 
@@ -109,7 +566,7 @@ QString codeplace::getFilename () const {
     // TODO: behind the scenes mutation into using a QString?
     // would need to be thread safe if so
     if ((_options & Options::FilenameIsQString) != Options::None) {
-        return *_filenameQString;
+        return _filenameShared->filename;
     }
     return QString(_filenameCString);
 }
@@ -123,29 +580,7 @@ long codeplace::getLine () const {
 
 QUuid codeplace::getUuid () const {
     assert(_options != Options::None);
-
-    if ((_options & Options::Permanent) != Options::None) {
-        if ((_options & Options::UuidIsQString) != Options::None) {
-            return UuidFromBase64String((*_uuidQString).toLatin1());
-        }
-        return UuidFromBase64String(QByteArray(_uuidCString));
-    } else if ((_options & Options::Hashed) != Options::None) {
-        // TODO: Decide what string format will hash best
-        QString fileAndLine;
-        if ((_options & Options::FilenameIsQString) != Options::None)
-            fileAndLine = QString::number(_line, 10) + *_filenameQString;
-        else
-            fileAndLine = QString::number(_line, 10) + _filenameCString;
-
-        QByteArray bytes = QCryptographicHash::hash(
-            fileAndLine.toUtf8(), QCryptographicHash::Md4
-        );
-
-        return UuidFrom128Bits(bytes);
-    } else {
-        // null uuid for null codeplace... should be caught above
-        return QUuid ();
-    }
+    return UuidFrom128Bits(_uuidBits);
 }
 
 
@@ -155,10 +590,79 @@ codeplace::operator QUuid () const {
 
 
 QString codeplace::toString () const {
-    QString result;
-    QTextStream ts (&result);
-    ts << "File: '" << getFilename() << "' - " << " Line # " << getLine();
-    return result;
+    char buffer[FormatBufferSize];
+    size_t const length = format(buffer);
+    return QString::fromUtf8(buffer, static_cast<int>(length));
+}
+
+
+char const * codeplace::getFilenameUtf8 () const {
+    assert(_options != Options::None);
+
+    if ((_options & Options::FilenameIsQString) != Options::None)
+        return _filenameShared->filenameUtf8.constData();
+    return _filenameCString;
+}
+
+
+size_t codeplace::format (char * buffer, size_t size) const {
+    format_writer writer (buffer, size);
+
+    // Streaming a location that wasn't kept (e.g. whereConstructed() of a
+    // stacked built with HOIST_NO_TRACKING) shouldn't bring the program down
+    if (_options == Options::None) {
+        writer.append("(no codeplace)");
+        return writer.finish();
+    }
+
+    writer.append("File: '");
+    writer.append(getFilenameUtf8());
+    writer.append("' -  Line # ");
+    writer.appendDecimal(_line);
+    return writer.finish();
+}
+
+
+size_t codeplace::formatUuid (char * buffer, size_t size) const {
+    assert(_options != Options::None);
+
+    // 8-4-4-4-12 hex digits, as QUuid::toString() has it
+    char chars[UuidFormatSize];
+    char * out = chars;
+    *out++ = '{';
+    for (int digit = 0; digit < 32; digit++) {
+        if (digit == 8 or digit == 12 or digit == 16 or digit == 20)
+            *out++ = '-';
+        uint64_t const word = digit < 16 ? _uuidBits.high : _uuidBits.low;
+        *out++ = "0123456789abcdef"[(word >> (60 - (digit % 16) * 4)) & 0xF];
+    }
+    *out++ = '}';
+    *out = '\0';
+
+    format_writer writer (buffer, size);
+    writer.append(chars);
+    return writer.finish();
+}
+
+
+QTextStream & operator<< (QTextStream & ts, codeplace const & cp) {
+    char buffer[codeplace::FormatBufferSize];
+    size_t const length = cp.format(buffer);
+
+    // __FILE__ is nearly always plain ASCII, which Latin-1 can take as is
+    bool ascii = true;
+    for (size_t index = 0; index < length; index++) {
+        if (static_cast<unsigned char>(buffer[index]) >= 0x80) {
+            ascii = false;
+            break;
+        }
+    }
+
+    if (ascii)
+        ts << QLatin1String (buffer, static_cast<int>(length));
+    else
+        ts << QString::fromUtf8(buffer, static_cast<int>(length));
+    return ts;
 }
 
 
@@ -167,42 +671,47 @@ bool codeplace::isPermanent () const {
 }
 
 
+bool codeplace::isNull () const {
+    return _options == Options::None;
+}
+
+
 void codeplace::transitionToNull () {
     if ((_options & Options::FilenameIsQString) != Options::None) {
-        delete _filenameQString;
-        _filenameQString = nullptr;
-    }
-
-    if (
-        (_options & (Options::Permanent | Options::UuidIsQString))
-        != Options::None
-    ) {
-        delete _uuidQString;
-        _uuidQString = nullptr;
+        if (not _filenameShared->refs.deref())
+            delete _filenameShared;
+        _filenameShared = nullptr;
     }
 }
 
 void codeplace::transitionFromNull (codeplace const & other) {
-    _options = other._options;
-
-    if (other._options == Options::None)
+    // A null codeplace compares and hashes by its zero uuid bits, so none
+    // of what this one held before can be left behind
+    if (other._options == Options::None) {
+        clearToNull();
         return;
+    }
+
+    _options = other._options;
+    _siteIndex = other._siteIndex;
 
     if ((other._options & Options::FilenameIsQString) != Options::None) {
-        _filenameQString = new QString (*other._filenameQString);
+        _filenameShared = other._filenameShared;
+        _filenameShared->refs.ref();
     } else {
         _filenameCString = other._filenameCString;
     }
 
-    if ((other._options & Options::Permanent) != Options::None) {
-        if ((other._options & Options::UuidIsQString) != Options::None) {
-            _uuidQString = new QString (*other._uuidQString);
-        } else {
-            _uuidCString = other._uuidCString;
-        }
-    }
-
     _line = other._line;
+    _uuidBits = other._uuidBits;
+}
+
+void codeplace::clearToNull () {
+    _options = Options::None;
+    _siteIndex = 0;
+    _filenameEither = nullptr;
+    _line = -1;
+    _uuidBits = uuid128 ();
 }
 
 
@@ -211,14 +720,11 @@ codeplace::codeplace (
     long const & line,
     QString const & uuidString
 ) :
-    _options (
-        Options::Permanent
-        | Options::FilenameIsQString
-        | Options::UuidIsQString
-    ),
-    _filenameQString (new QString (filename)),
+    _options (Options::Permanent | Options::FilenameIsQString),
+    _siteIndex (0),
+    _filenameShared (new shared_filename (filename)),
     _line (line),
-    _uuidQString (new QString (uuidString))
+    _uuidBits (Uuid128FromBase64String(uuidString.toLatin1().constData()))
 {
 }
 
@@ -229,27 +735,59 @@ codeplace::codeplace (
     char const * uuidString
 ) :
     _options (Options::Permanent),
+    _siteIndex (0),
     _filenameCString (filename),
     _line (line),
-    _uuidCString (uuidString)
+    _uuidBits (Uuid128FromBase64String(uuidString))
 {
 }
 
 
 codeplace::codeplace (QString const & filename, long const & line) :
     _options (Options::Hashed | Options::FilenameIsQString),
-    _filenameQString (new QString (filename)),
+    _siteIndex (0),
+    _filenameShared (new shared_filename (filename)),
     _line (line),
-    _uuidEither (nullptr)
+    _uuidBits (Uuid128FromHashedFileAndLine(filename, line))
 {
 }
 
 
 codeplace::codeplace (char const * filename, long const & line) :
     _options (Options::Hashed),
+    _siteIndex (0),
     _filenameCString (filename),
     _line (line),
-    _uuidEither (nullptr)
+    _uuidBits (Uuid128FromHashedFileAndLine(QString (filename), line))
+{
+}
+
+
+codeplace::codeplace (
+    char const * filename,
+    long const & line,
+    uuid128 const & hashedUuid
+) :
+    _options (Options::Hashed),
+    _siteIndex (0),
+    _filenameCString (filename),
+    _line (line),
+    _uuidBits (hashedUuid)
+{
+}
+
+
+codeplace::codeplace (
+    char const * filename,
+    long const & line,
+    uuid128 const & uuid,
+    Options const & options
+) :
+    _options (options),
+    _siteIndex (0),
+    _filenameCString (filename),
+    _line (line),
+    _uuidBits (uuid)
 {
 }
 
@@ -264,16 +802,45 @@ codeplace codeplace::makeHere (char const * filename, long const & line) {
 
 
 codeplace codeplace::makeHere (QString const & filename, long const & line) {
-    return codeplace (filename, line);
+    codeplace result (filename, line);
+    result._siteIndex = remember(result)._index;
+    return result;
+}
+
+
+codeplace codeplace::makeHere (
+    char const * filename,
+    long const & line,
+    uuid128 const & hashedUuid,
+    codesite const & site
+) {
+    codeplace result (filename, line, hashedUuid);
+    result._siteIndex = site._index;
+    return result;
 }
 
 
 codeplace codeplace::makePlace (
     char const * filename,
     long const & line,
-    char const * uuidString
+    char const * uuidString,
+    codesite const & site
 ) {
-    return codeplace (filename, line, uuidString);
+    codeplace result (filename, line, uuidString);
+    result._siteIndex = site._index;
+    return result;
+}
+
+
+codeplace codeplace::makePlace (
+    char const * filename,
+    long const & line,
+    uuid128 const & uuid,
+    codesite const & site
+) {
+    codeplace result (filename, line, uuid, Options::Permanent);
+    result._siteIndex = site._index;
+    return result;
 }
 
 
@@ -282,7 +849,9 @@ codeplace codeplace::makePlace (
     long const & line,
     QString const & uuidString
 ) {
-    return codeplace (filename, line, uuidString);
+    codeplace result (filename, line, uuidString);
+    result._siteIndex = remember(result)._index;
+    return result;
 }
 
 
@@ -291,8 +860,15 @@ codeplace codeplace::makeThere (
     long const & line,
     codeplace const & cp
 ) {
-    QString uuidString = Base64StringFromUuid(cp.getUuid());
-    return codeplace (filename, line, uuidString);
+    // No need to round-trip the uuid through a base64 string any more
+    codeplace result (
+        InternedFilename(filename),
+        line,
+        cp.getUuid128(),
+        Options::Permanent
+    );
+    result._siteIndex = remember(result)._index;
+    return result;
 }
 
 
@@ -309,9 +885,109 @@ codeplace codeplace::makeYonder (
     // TODO: Fix this to comply with UUID format rules, random or hashed
     // bits will contain lies in the bits indicating what protocol the
     // UUID was generated in accordance with (e.g. a pseudo-UUID)
-    QString uuidString = Base64StringFromUuid(UuidFrom128Bits(bytes));
+    assert(cp._options != Options::None);
+
+    // A filename that isn't already a permanent char const * gets interned
+    char const * filename =
+        (cp._options & Options::FilenameIsQString) != Options::None
+        ? InternedFilename(cp._filenameShared->filename)
+        : cp._filenameCString;
+
+    codeplace result (
+        filename,
+        cp.getLine(),
+        Uuid128FromUuid(UuidFrom128Bits(bytes)),
+        Options::Permanent | Options::Transient
+    );
+    return result;
+}
+
+
+
+
+///
+/// Registry
+///
+
+codesite codeplace::remember (codeplace const & cp) {
+    if (cp._siteIndex != 0)
+        return codesite (cp._siteIndex);
+
+    // A malformed PLACE uuid decodes as null, and is not worth remembering
+    if (
+        cp._options == Options::None
+        or (cp._options & Options::Transient) != Options::None
+        or cp._uuidBits.isNull()
+    ) {
+        return codesite ();
+    }
+
+    if (
+        registry_slot const * slot = RegistryFind(
+            cp._uuidBits, cp.getFilenameUtf8(), cp._line
+        )
+    ) {
+        return codesite (slot->index);
+    }
+
+    // The registry outlives everything, so its filenames must be permanent
+    char const * filename =
+        (cp._options & Options::FilenameIsQString) != Options::None
+        ? InternedFilename(cp._filenameShared->filename)
+        : cp._filenameCString;
+
+    return codesite (RegistryInsert(
+        cp._uuidBits,
+        filename,
+        cp._line,
+        cp._options & (Options::Hashed | Options::Permanent)
+    ));
+}
+
+
+codeplace codeplace::lookup (uuid128 const & uuid) {
+    registry_slot const * slot = RegistryFind(uuid);
+    if (not slot)
+        return codeplace ();
+
+    codeplace result (slot->filename, slot->line, uuid, slot->options);
+    result._siteIndex = slot->index;
+    return result;
+}
+
+
+codeplace codeplace::lookup (QUuid const & uuid) {
+    return lookup(Uuid128FromUuid(uuid));
+}
+
+
+codeplace codeplace::lookup (codesite const & site) {
+    if (site._index == 0)
+        return codeplace ();
+
+    // A codesite can only be had from a published slot
+    registry_slot const * slot = RegistrySite(site._index, false)->load(
+        std::memory_order_acquire
+    );
+
+    codeplace result (
+        slot->filename,
+        slot->line,
+        uuid128 (slot->high, slot->low),
+        slot->options
+    );
+    result._siteIndex = site._index;
+    return result;
+}
+
+
+codeplace::site_counters * codeplace::counters (codesite const & site) {
+    if (site._index == 0)
+        return nullptr;
 
-    return codeplace (cp.getFilename(), cp.getLine(), uuidString);
+    return &RegistrySite(site._index, false)->load(
+        std::memory_order_acquire
+    )->counters;
 }
 
 
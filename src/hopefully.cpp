@@ -13,10 +13,470 @@
 #include "hoist/hopefully.h"
 
 #include <QDebug>
+#include <QDateTime>
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace hoist {
 
-hope_failed_handler globalHopeFailedHandler = nullptr;
+// Read on every failure from any thread, so it is atomic.  A thread with a
+// scoped_hope_failed_handler uses the innermost one of those instead.
+
+std::atomic<hope_failed_handler> globalHopeFailedHandler (nullptr);
+
+thread_local scoped_hope_failed_handler * threadHopeFailedHandler = nullptr;
+
+
+namespace {
+
+std::atomic<uint64_t> hopeReportFirst (UINT64_MAX);
+
+std::atomic<int64_t> hopeSummaryMsecs (1000);
+
+
+// Sites with failures that were held back and not yet summarized.  Leaked
+// on purpose, as a failure may be counted during static destruction.
+
+std::mutex & PendingSummaryMutex() {
+    static std::mutex & mutex = *new std::mutex;
+    return mutex;
+}
+
+std::vector<codesite> & PendingSummaries() {
+    static std::vector<codesite> & sites = *new std::vector<codesite>;
+    return sites;
+}
+
+
+void HoldHopeFailed(
+    codesite const & site,
+    codeplace::site_counters & counters
+) {
+    if (counters.summaryPending.exchange(true))
+        return;
+
+    std::lock_guard<std::mutex> lock (PendingSummaryMutex());
+    PendingSummaries().push_back(site);
+}
+
+
+int64_t SteadyMsecs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+
+// Raises the count of failures the handler has heard about to total, and
+// gives what it was before.  Threads race to do this with totals taken at
+// different moments, so it only ever moves up: a slower thread with an
+// older total must not bring back failures that were already summarized.
+
+uint64_t RaiseReportedFailures(
+    codeplace::site_counters & counters,
+    uint64_t const total
+) {
+    uint64_t reported = counters.reportedFailures.load();
+    while (
+        reported < total
+        and not counters.reportedFailures.compare_exchange_weak(
+            reported, total
+        )
+    ) {
+    }
+    return std::min(reported, total);
+}
+
+
+// Counts the failure, and says whether the handler should hear about it.
+// When a summary is due, moreFailures is how many there were since the
+// last time the handler was called for this site.
+
+enum class hope_delivery { Report, Summarize, Suppress };
+
+hope_delivery CountHopeFailed(
+    codeplace const & cp,
+    uint64_t & totalFailures,
+    uint64_t & moreFailures
+) {
+    codesite const site = cp.isNull() ? codesite () : codesite (cp);
+    codeplace::site_counters * counters = codeplace::counters(site);
+    if (not counters)
+        return hope_delivery::Report;
+
+    totalFailures = counters->failures.fetch_add(1) + 1;
+
+    if (totalFailures <= hopeReportFirst.load(std::memory_order_relaxed)) {
+        RaiseReportedFailures(*counters, totalFailures);
+        counters->lastReportMsecs.store(SteadyMsecs());
+        return hope_delivery::Report;
+    }
+
+    int64_t const interval = hopeSummaryMsecs.load(std::memory_order_relaxed);
+    if (interval < 0)
+        return hope_delivery::Suppress;
+
+    int64_t const now = SteadyMsecs();
+    int64_t last = counters->lastReportMsecs.load();
+
+    // Of the threads that notice the interval is up, one gets to summarize
+    if (
+        now - last < interval
+        or not counters->lastReportMsecs.compare_exchange_strong(last, now)
+    ) {
+        HoldHopeFailed(site, *counters);
+        return hope_delivery::Suppress;
+    }
+
+    // zero if a thread with a later total has already reported this one
+    moreFailures = totalFailures
+        - RaiseReportedFailures(*counters, totalFailures);
+    return moreFailures == 0
+        ? hope_delivery::Suppress
+        : hope_delivery::Summarize;
+}
+
+
+// null means the default, onHopeFailedBasic
+hope_failed_handler CurrentHopeFailedHandler() {
+    return threadHopeFailedHandler
+        ? threadHopeFailedHandler->handler()
+        : globalHopeFailedHandler.load(std::memory_order_acquire);
+}
+
+
+void CallHopeFailedHandler(QString const & message, codeplace const & cp) {
+    hope_failed_handler const handler = CurrentHopeFailedHandler();
+    if (handler) {
+        (*handler)(message, cp);
+    } else {
+        onHopeFailedBasic(message, cp);
+    }
+}
+
+
+
+///
+/// Asynchronous delivery
+///
+
+// Bounded multi-producer queue after Dmitry Vyukov's design.  Each cell
+// has a sequence number saying whether it's free for the producer at that
+// position or filled for the consumer, so producers only contend on the
+// enqueue position and nobody takes a lock.
+
+struct hope_failed_cell
+{
+    std::atomic<size_t> sequence;
+    hope_failed_record record;
+};
+
+
+class hope_failed_queue final
+{
+public:
+    hope_failed_queue (
+        size_t capacity,
+        hope_failed_overflow overflow,
+        hope_failed_batch_handler batchHandler
+    ) :
+        _cells (new hope_failed_cell[capacity]),
+        _mask (capacity - 1),
+        _overflow (overflow),
+        _batchHandler (batchHandler),
+        _enqueuePos (0),
+        _enqueuePadding (),
+        _dequeuePos (0),
+        _delivered (0),
+        _consumerWaiting (false),
+        _stopping (false)
+    {
+        for (size_t index = 0; index < capacity; index++)
+            _cells[index].sequence.store(index, std::memory_order_relaxed);
+    }
+
+    ~hope_failed_queue () {
+        delete [] _cells;
+    }
+
+    // false if the record was dropped because the queue was full
+    bool push (hope_failed_record const & record) {
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        hope_failed_cell * cell;
+        while (true) {
+            cell = &_cells[pos & _mask];
+            size_t const sequence
+                = cell->sequence.load(std::memory_order_acquire);
+            intptr_t const diff
+                = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (
+                    _enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed
+                    )
+                ) {
+                    break;
+                }
+            } else if (diff < 0) {
+                if (_overflow == hope_failed_overflow::Drop)
+                    return false;
+                wakeConsumer();
+                std::this_thread::yield();
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            } else {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->record = record;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        if (_consumerWaiting.load())
+            wakeConsumer();
+        return true;
+    }
+
+    // Runs on the delivery thread until stop(), and then until it's empty
+    void run () {
+        std::vector<hope_failed_record> batch;
+        batch.reserve(batchLimit);
+
+        while (true) {
+            while (batch.size() < batchLimit) {
+                hope_failed_cell & cell = _cells[_dequeuePos & _mask];
+                if (
+                    cell.sequence.load(std::memory_order_acquire)
+                    != _dequeuePos + 1
+                ) {
+                    break;
+                }
+                batch.push_back(std::move(cell.record));
+                cell.record.place = codeplace ();
+                cell.record.message = QString ();
+                cell.sequence.store(
+                    _dequeuePos + _mask + 1, std::memory_order_release
+                );
+                _dequeuePos++;
+            }
+
+            if (not batch.empty()) {
+                deliver(batch);
+                {
+                    std::lock_guard<std::mutex> lock (_mutex);
+                    _delivered += batch.size();
+                }
+                _flushed.notify_all();
+                batch.clear();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock (_mutex);
+            if (_stopping) {
+                if (isEmpty())
+                    return;
+                continue;
+            }
+            _consumerWaiting.store(true);
+            if (isEmpty()) {
+                // the timeout is only a backstop for a missed wakeup
+                _wakeup.wait_for(lock, std::chrono::milliseconds (100));
+            }
+            _consumerWaiting.store(false);
+        }
+    }
+
+    bool hasBatchHandler () const {
+        return _batchHandler != nullptr;
+    }
+
+    void flush () {
+        size_t const target = _enqueuePos.load();
+        std::unique_lock<std::mutex> lock (_mutex);
+        while (_delivered < target) {
+            _wakeup.notify_one();
+            _flushed.wait_for(lock, std::chrono::milliseconds (100));
+        }
+    }
+
+    // Only called once no producer can still be inside push()
+    void stop () {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _stopping = true;
+        _wakeup.notify_one();
+    }
+
+private:
+    bool isEmpty () const {
+        return _cells[_dequeuePos & _mask].sequence.load() != _dequeuePos + 1;
+    }
+
+    void wakeConsumer () {
+        std::lock_guard<std::mutex> lock (_mutex);
+        _wakeup.notify_one();
+    }
+
+    void deliver (std::vector<hope_failed_record> const & batch) {
+        if (_batchHandler) {
+            (*_batchHandler)(batch.data(), batch.size());
+            return;
+        }
+        for (hope_failed_record const & record : batch)
+            CallHopeFailedHandler(record.message, record.place);
+    }
+
+private:
+    static size_t const batchLimit = 64;
+
+    hope_failed_cell * const _cells;
+    size_t const _mask;
+    hope_failed_overflow const _overflow;
+    hope_failed_batch_handler const _batchHandler;
+
+    // padded so the producers' position and the consumer's don't share a
+    // cache line (alignas would need an aligned operator new before C++17)
+    std::atomic<size_t> _enqueuePos;
+    char _enqueuePadding[64];
+    size_t _dequeuePos;
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::condition_variable _flushed;
+    size_t _delivered;
+    std::atomic<bool> _consumerWaiting;
+    bool _stopping;
+};
+
+
+// Anyone touching the queue counts themselves in hopeQueueUsers first, so
+// that stopping can take the queue away and then wait for them to leave
+// before it is destroyed.
+
+std::atomic<hope_failed_queue *> hopeQueue (nullptr);
+
+std::atomic<int> hopeQueueUsers (0);
+
+std::atomic<uint64_t> hopeQueueDrops (0);
+
+std::mutex hopeThreadMutex;
+
+std::thread hopeThread;
+
+thread_local bool onHopeFailedThread = false;
+
+// Set while onHopeFailedBasic is flushing what came before it
+thread_local bool flushingForBasicHandler = false;
+
+
+// false if the failure should be delivered on this thread instead
+bool EnqueueHopeFailed(QString const & message, codeplace const & cp) {
+    // A scoped handler is for this thread's failures, so it runs here
+    if (onHopeFailedThread or threadHopeFailedHandler)
+        return false;
+
+    hopeQueueUsers.fetch_add(1);
+    bool queued = false;
+    hope_failed_queue * queue = hopeQueue.load();
+
+    // With only the default handler to go to, the failure is fatal and
+    // halts here
+    if (
+        queue
+        and (
+            queue->hasBatchHandler()
+            or globalHopeFailedHandler.load(std::memory_order_acquire)
+        )
+    ) {
+        // The codeplace goes in the record too, so a place that has no
+        // site in the registry (a YONDER, or a null one) still says where
+        hope_failed_record const record = {
+            codesite (cp),
+            cp,
+            message,
+            QThread::currentThreadId(),
+            QDateTime::currentMSecsSinceEpoch()
+        };
+        if (not queue->push(record))
+            hopeQueueDrops.fetch_add(1);
+        queued = true;
+    }
+    hopeQueueUsers.fetch_sub(1);
+    return queued;
+}
+
+
+void DeliverHopeFailed(QString const & message, codeplace const & cp) {
+    if (not EnqueueHopeFailed(message, cp))
+        CallHopeFailedHandler(message, cp);
+}
+
+
+QString HopeFailedSummary(
+    QString const & message,
+    uint64_t totalFailures,
+    uint64_t moreFailures
+) {
+    return QString ("%1 (failed %2 more times since last report, %3 in all)")
+        .arg(message)
+        .arg(moreFailures)
+        .arg(totalFailures);
+}
+
+
+// The summaries that the limits would otherwise only send on the next
+// failure at the site, which might never come
+
+void DeliverHeldHopeFailed() {
+    std::vector<codesite> pending;
+    {
+        std::lock_guard<std::mutex> lock (PendingSummaryMutex());
+        pending.swap(PendingSummaries());
+    }
+
+    for (codesite const & site : pending) {
+        codeplace::site_counters * counters = codeplace::counters(site);
+        counters->summaryPending.store(false);
+
+        uint64_t const total = counters->failures.load();
+        uint64_t const more = total - RaiseReportedFailures(*counters, total);
+        if (more != 0) {
+            counters->lastReportMsecs.store(SteadyMsecs());
+            DeliverHopeFailed(
+                HopeFailedSummary("Hope failed", total, more), site
+            );
+        }
+    }
+}
+
+
+std::atomic<uint32_t> hopeDefaultSampling (1);
+
+// A per-thread xorshift, so that sampling doesn't write to anything shared
+thread_local uint32_t hopeSampleState = 0;
+
+uint32_t NextHopeSample() {
+    uint32_t state = hopeSampleState;
+    if (state == 0) {
+        state = static_cast<uint32_t>(
+            reinterpret_cast<uintptr_t>(&hopeSampleState) ^ SteadyMsecs()
+        ) | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    hopeSampleState = state;
+    return state;
+}
+
+} // end anonymous namespace
 
 
 // I'd like to include a dialog-based implementation that communicates with a
@@ -25,15 +485,36 @@ hope_failed_handler globalHopeFailedHandler = nullptr;
 
 void onHopeFailedBasic(QString const & message, codeplace const & cp)
 {
+    // Whatever went wrong earlier may explain this, so get it out first.
+    // (qt_assert_x below doesn't return in a debug build.)  A held summary
+    // that the flush delivers can come back here, and mustn't flush again.
+    if (not flushingForBasicHandler) {
+        flushingForBasicHandler = true;
+        flushHopeFailed();
+        flushingForBasicHandler = false;
+    }
+
+    // Stack buffers, so reporting doesn't add allocations of its own
+    char where[codeplace::FormatBufferSize];
+    cp.format(where);
+
+    // A location that wasn't kept (as with HOIST_NO_TRACKING) comes in as a
+    // null codeplace, which has no uuid, file or line to ask for
+    char uuidBuffer[codeplace::UuidFormatSize];
+    char const * uuid = where;
+    char const * filename = "(unknown file)";
+    long line = 0;
+    if (not cp.isNull()) {
+        cp.formatUuid(uuidBuffer);
+        uuid = uuidBuffer;
+        filename = cp.getFilenameUtf8();
+        line = cp.getLine();
+    }
+
     qDebug() << message << endl
-        << "     output from: " << cp.toString() << endl;
+        << "     output from: " << where << endl;
 
-    qt_assert_x(
-        message.toLatin1(),
-        cp.getUuid().toString().toLatin1(),
-        cp.getFilename().toLatin1(),
-        cp.getLine()
-    );
+    qt_assert_x(message.toLatin1(), uuid, filename, line);
 
     // hoist encourages "ship what you test" and the hopefully functions do
     // not disappear in the release build.  Yet they return a value which can
@@ -51,9 +532,9 @@ void onHopeFailedBasic(QString const & message, codeplace const & cp)
     qFatal(
         "%s in %s of %s, line %ld",
         message.toLocal8Bit().data(),
-        cp.getUuid().toString().toLocal8Bit().data(),
-        cp.getFilename().toLocal8Bit().data(),
-        cp.getLine()
+        uuid,
+        filename,
+        line
     );
 }
 
@@ -61,19 +542,40 @@ void onHopeFailedBasic(QString const & message, codeplace const & cp)
 hope_failed_handler setHopeFailedHandlerAndReturnOldHandler(
     hope_failed_handler const & newHandler
 ) {
-    hope_failed_handler result = 
-        globalHopeFailedHandler
-        ? globalHopeFailedHandler
-        : &onHopeFailedBasic;
+    hope_failed_handler result = globalHopeFailedHandler.load();
 
     if (hopefully(newHandler, "Null passed to setHopeFailedHandler", HERE)) {
-        if (newHandler == &onHopeFailedBasic) {
-            globalHopeFailedHandler = nullptr;
-        } else {
-            globalHopeFailedHandler = newHandler;
-        }
+        result = globalHopeFailedHandler.exchange(
+            newHandler == &onHopeFailedBasic ? nullptr : newHandler
+        );
     }
-    return result;
+    return result ? result : &onHopeFailedBasic;
+}
+
+
+scoped_hope_failed_handler::scoped_hope_failed_handler (
+    hope_failed_handler const & handler
+) :
+    _handler (
+        hopefully(handler, "Null passed to scoped_hope_failed_handler", HERE)
+            ? handler
+            : &onHopeFailedBasic
+    ),
+    _previous (threadHopeFailedHandler)
+{
+    threadHopeFailedHandler = this;
+}
+
+
+scoped_hope_failed_handler::~scoped_hope_failed_handler () {
+    // not hopefully(), which would be reported through this very handler
+    assert(threadHopeFailedHandler == this);
+    threadHopeFailedHandler = _previous;
+}
+
+
+hope_failed_handler scoped_hope_failed_handler::handler () const {
+    return _handler;
 }
 
 
@@ -83,17 +585,164 @@ hope_failed_handler setHopeFailedHandlerAndReturnOldHandler(
 // you hope is true rather than what is not true...
 
 bool hopefullyNotReached (
-    QString const & message,
+    hope_message const & message,
     codeplace const & cp
 ) {
-    if (globalHopeFailedHandler) {
-        (*globalHopeFailedHandler)(message, cp);
-    } else {
-        onHopeFailedBasic(message, cp);
+    // The message isn't made until we know it will be delivered
+    uint64_t totalFailures = 0;
+    uint64_t moreFailures = 0;
+    switch (CountHopeFailed(cp, totalFailures, moreFailures)) {
+    case hope_delivery::Report:
+        DeliverHopeFailed(message(), cp);
+        break;
+
+    case hope_delivery::Summarize:
+        DeliverHopeFailed(
+            HopeFailedSummary(message(), totalFailures, moreFailures), cp
+        );
+        break;
+
+    case hope_delivery::Suppress:
+        break;
     }
 
     // return false, for consistency with other hopefully(*) boolean-returners
     return false;
 }
 
+
+bool hopefullyNotReached (
+    QString const & message,
+    codeplace const & cp
+) {
+    auto makeMessage = [&]() { return message; };
+    return hopefullyNotReached(hope_message (makeMessage), cp);
+}
+
+
+bool hopefullyNotReached (char const * message, codeplace const & cp) {
+    auto makeMessage = [&]() { return QString (message); };
+    return hopefullyNotReached(hope_message (makeMessage), cp);
+}
+
+
+bool hopeSampleDue (codesite const & site) {
+    // 0 in the registry means no setting, otherwise it is the setting + 1
+    codeplace::site_counters * counters = codeplace::counters(site);
+    uint32_t const stored = counters
+        ? counters->sampling.load(std::memory_order_relaxed)
+        : 0;
+    uint32_t const every = stored == 0
+        ? hopeDefaultSampling.load(std::memory_order_relaxed)
+        : stored - 1;
+
+    if (every <= 1)
+        return every == 1;
+    return NextHopeSample() % every == 0;
+}
+
+
+bool setHopeSampling (codeplace const & cp, uint32_t every) {
+    codeplace::site_counters * counters
+        = cp.isNull() ? nullptr : codeplace::counters(codesite (cp));
+    if (not counters)
+        return false;
+
+    // UINT32_MAX + 1 would wrap to "no setting", so that one is kept short
+    counters->sampling.store(
+        every == UINT32_MAX ? every : every + 1, std::memory_order_relaxed
+    );
+    return true;
+}
+
+
+bool setHopeSampling (uuid128 const & uuid, uint32_t every) {
+    return setHopeSampling(codeplace::lookup(uuid), every);
+}
+
+
+void setDefaultHopeSampling (uint32_t every) {
+    hopeDefaultSampling.store(every, std::memory_order_relaxed);
+}
+
+
+void setHopeFailedLimits (uint64_t reportFirst, int64_t summaryMsecs) {
+    hopeReportFirst.store(reportFirst);
+    hopeSummaryMsecs.store(summaryMsecs);
+}
+
+
+uint64_t hopeFailedCount (codeplace const & cp) {
+    codeplace::site_counters * counters
+        = cp.isNull() ? nullptr : codeplace::counters(codesite (cp));
+    return counters ? counters->failures.load() : 0;
+}
+
+
+void startHopeFailedThread (
+    size_t capacity,
+    hope_failed_overflow overflow,
+    hope_failed_batch_handler batchHandler
+) {
+    std::lock_guard<std::mutex> lock (hopeThreadMutex);
+    if (hopeQueue.load())
+        return;
+
+    size_t rounded = 2;
+    while (rounded < capacity)
+        rounded *= 2;
+
+    hope_failed_queue * queue
+        = new hope_failed_queue (rounded, overflow, batchHandler);
+
+    hopeThread = std::thread ([queue]() {
+        onHopeFailedThread = true;
+        queue->run();
+    });
+    hopeQueue.store(queue);
+
+    // a joinable std::thread at exit would terminate the program
+    static bool registered = false;
+    if (not registered) {
+        std::atexit(&stopHopeFailedThread);
+        registered = true;
+    }
+}
+
+
+void stopHopeFailedThread () {
+    if (not onHopeFailedThread)
+        DeliverHeldHopeFailed();
+
+    std::lock_guard<std::mutex> lock (hopeThreadMutex);
+    hope_failed_queue * queue = hopeQueue.exchange(nullptr);
+    if (not queue)
+        return;
+
+    while (hopeQueueUsers.load() != 0)
+        std::this_thread::yield();
+
+    queue->stop();
+    hopeThread.join();
+    delete queue;
+}
+
+
+void flushHopeFailed () {
+    if (onHopeFailedThread)
+        return;
+
+    DeliverHeldHopeFailed();
+
+    hopeQueueUsers.fetch_add(1);
+    if (hope_failed_queue * queue = hopeQueue.load())
+        queue->flush();
+    hopeQueueUsers.fetch_sub(1);
+}
+
+
+uint64_t hopeFailedDropCount () {
+    return hopeQueueDrops.load();
+}
+
 } // end namespace hoist
@@ -0,0 +1,630 @@
+//
+//  manifest.cpp - Source tree indexer that writes the codeplace manifest,
+//  and the memory-mapped reader for it.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/manifest.h"
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QHash>
+#include <QStringList>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace hoist {
+
+namespace {
+
+//
+// File layout, in host byte order:
+//
+//     manifest_header
+//     manifest_record[count], sorted by (high, low)
+//     string table of NUL-terminated UTF-8, referenced by byte offset
+//
+
+char const manifestMagic[8] = {'H', 'O', 'I', 'S', 'T', 'M', 'F', '1'};
+
+struct manifest_header
+{
+    char magic[8];
+    uint32_t count;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+    uint32_t reserved[3];
+};
+
+struct manifest_record
+{
+    uint64_t high;
+    uint64_t low;
+    uint32_t filenameOffset;
+    uint32_t line;
+    uint32_t functionOffset;
+    uint32_t isPermanent;
+};
+
+static_assert(sizeof(manifest_header) == 32, "manifest header is 32 bytes");
+static_assert(sizeof(manifest_record) == 32, "manifest record is 32 bytes");
+
+
+struct found_site
+{
+    uuid128 uuid;
+    long line;
+    QByteArray function;
+    bool isPermanent;
+};
+
+
+bool IsIdentifierChar(char const c) {
+    return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z')
+        or (c >= '0' and c <= '9') or c == '_';
+}
+
+
+// The encoding prefixes that can come before a raw string's quote
+
+bool IsRawPrefix(QByteArray const & word) {
+    return word == "R" or word == "LR" or word == "uR" or word == "UR"
+        or word == "u8R";
+}
+
+
+bool IsControlKeyword(QByteArray const & word) {
+    return word == "if" or word == "for" or word == "while"
+        or word == "switch" or word == "catch" or word == "return"
+        or word == "sizeof" or word == "decltype" or word == "alignof";
+}
+
+
+//
+// This is not a C++ parser.  It skips comments and literals, finds PLACE
+// and HERE as whole tokens outside of preprocessor lines, and guesses the
+// enclosing function by remembering the (qualified) name in front of the
+// first parenthesis before each opening brace.
+//
+
+class site_scanner final
+{
+public:
+    site_scanner (QByteArray const & text, QByteArray const & hashedFilename) :
+        _text (text),
+        _hashedFilename (hashedFilename),
+        _pos (0),
+        _line (1)
+    {
+    }
+
+    std::vector<found_site> scan () {
+        std::vector<found_site> sites;
+
+        QByteArray qualified; // e.g. "codeplace::makeHere"
+        bool afterScope = false;
+        QByteArray candidate; // name before the first '(' of a statement
+        int parenDepth = 0;
+        bool frozen = false; // past "):" of a constructor's initializers
+        bool lineIsPreprocessor = false;
+        bool lineHasCode = false;
+        std::vector<QByteArray> braces;
+
+        while (_pos < _text.size()) {
+            char const c = _text[_pos];
+
+            if (c == '\n') {
+                _line++;
+                _pos++;
+                // a preprocessor line continues if it ends in a backslash
+                if (not (_pos >= 2 and _text[_pos - 2] == '\\'))
+                    lineIsPreprocessor = false;
+                lineHasCode = false;
+                continue;
+            }
+
+            if (c == '/' and peek(1) == '/') {
+                while (_pos < _text.size() and _text[_pos] != '\n')
+                    _pos++;
+                continue;
+            }
+
+            if (c == '/' and peek(1) == '*') {
+                _pos += 2;
+                while (
+                    _pos < _text.size()
+                    and not (_text[_pos] == '*' and peek(1) == '/')
+                ) {
+                    if (_text[_pos] == '\n')
+                        _line++;
+                    _pos++;
+                }
+                _pos += 2;
+                continue;
+            }
+
+            if (c == '"' or c == '\'') {
+                skipLiteral(c);
+                continue;
+            }
+
+            if (c == '#' and not lineHasCode) {
+                lineIsPreprocessor = true;
+                _pos++;
+                continue;
+            }
+
+            if (c == ' ' or c == '\t' or c == '\r') {
+                _pos++;
+                continue;
+            }
+            lineHasCode = true;
+
+            if (
+                IsIdentifierChar(c)
+                or (c == '~' and IsIdentifierChar(peek(1)))
+            ) {
+                int const start = _pos;
+                bool const number = c >= '0' and c <= '9';
+                _pos++;
+                while (
+                    _pos < _text.size()
+                    and (
+                        IsIdentifierChar(_text[_pos])
+                        // digit separator, as in 1'000'000
+                        or (
+                            number and _text[_pos] == '\''
+                            and IsIdentifierChar(peek(1))
+                        )
+                    )
+                ) {
+                    _pos++;
+                }
+                QByteArray const word = _text.mid(start, _pos - start);
+
+                if (peek(0) == '"' and IsRawPrefix(word)) {
+                    skipRawLiteral();
+                    continue;
+                }
+
+                if (not lineIsPreprocessor) {
+                    if (word == "HERE")
+                        sites.push_back(hereSite(currentFunction(braces)));
+                    else if (word == "PLACE")
+                        placeSite(sites, currentFunction(braces));
+                }
+
+                qualified = afterScope ? qualified + word : word;
+                afterScope = false;
+                continue;
+            }
+
+            if (c == ':' and peek(1) == ':') {
+                qualified += "::";
+                afterScope = true;
+                _pos += 2;
+                continue;
+            }
+
+            afterScope = false;
+
+            if (c == '(') {
+                if (parenDepth == 0 and not frozen and candidate.isEmpty())
+                    candidate = qualified;
+                parenDepth++;
+            } else if (c == ')') {
+                if (parenDepth > 0)
+                    parenDepth--;
+            } else if (c == ':' and parenDepth == 0) {
+                // constructor initializer list, keep the name before it
+                if (not candidate.isEmpty())
+                    frozen = true;
+            } else if (c == ';') {
+                candidate.clear();
+                frozen = false;
+            } else if (c == '{') {
+                braces.push_back(
+                    IsControlKeyword(candidate) ? QByteArray () : candidate
+                );
+                candidate.clear();
+                frozen = false;
+                parenDepth = 0;
+            } else if (c == '}') {
+                if (not braces.empty())
+                    braces.pop_back();
+                candidate.clear();
+                frozen = false;
+            }
+            qualified.clear();
+            _pos++;
+        }
+
+        return sites;
+    }
+
+private:
+    char peek (int const offset) const {
+        return _pos + offset < _text.size() ? _text[_pos + offset] : '\0';
+    }
+
+    int skipBlanks (int scan) const {
+        while (
+            scan < _text.size() and (_text[scan] == ' ' or _text[scan] == '\t')
+        ) {
+            scan++;
+        }
+        return scan;
+    }
+
+    void skipLiteral (char const quote) {
+        _pos++;
+        while (_pos < _text.size() and _text[_pos] != quote) {
+            if (_text[_pos] == '\\')
+                _pos++;
+            // also counts the newline of a backslash continuation
+            if (_pos < _text.size() and _text[_pos] == '\n')
+                _line++;
+            _pos++;
+        }
+        _pos++;
+    }
+
+    // Expects to be at the opening quote of R"delimiter( ... )delimiter"
+    void skipRawLiteral () {
+        int const open = _text.indexOf('(', _pos);
+        if (open < 0) {
+            _pos = _text.size();
+            return;
+        }
+        QByteArray close (")");
+        close += _text.mid(_pos + 1, open - _pos - 1);
+        close += "\"";
+
+        int const end = _text.indexOf(close, open + 1);
+        int const stop = end < 0 ? _text.size() : end + close.size();
+        for (int scan = _pos; scan < stop; scan++) {
+            if (_text[scan] == '\n')
+                _line++;
+        }
+        _pos = stop;
+    }
+
+    static QByteArray currentFunction (
+        std::vector<QByteArray> const & braces
+    ) {
+        for (auto iter = braces.rbegin(); iter != braces.rend(); ++iter) {
+            if (not iter->isEmpty())
+                return *iter;
+        }
+        return QByteArray ();
+    }
+
+    found_site hereSite (QByteArray const & function) const {
+        // Same bytes that Uuid128FromFileAndLine hashes for __FILE__
+        QByteArray const bytes = QCryptographicHash::hash(
+            QByteArray::number(static_cast<qlonglong>(_line))
+                + _hashedFilename,
+            QCryptographicHash::Md4
+        );
+
+        uint64_t words[2] = {0, 0};
+        for (int index = 0; index < 16; index++) {
+            words[index / 8] = (words[index / 8] << 8)
+                | static_cast<uint8_t>(bytes[index]);
+        }
+
+        found_site site;
+        site.uuid = uuid128 (words[0], words[1]);
+        site.line = _line;
+        site.function = function;
+        site.isPermanent = false;
+        return site;
+    }
+
+    // Expects to be just past the PLACE token; takes PLACE("...") and
+    // ignores anything else (such as the macro's own definition)
+    void placeSite (
+        std::vector<found_site> & sites,
+        QByteArray const & function
+    ) {
+        int scan = skipBlanks(_pos);
+        if (scan >= _text.size() or _text[scan] != '(')
+            return;
+        scan = skipBlanks(scan + 1);
+        if (scan >= _text.size() or _text[scan] != '"')
+            return;
+        scan++;
+
+        int const start = scan;
+        while (
+            scan < _text.size() and _text[scan] != '"' and _text[scan] != '\n'
+        ) {
+            scan++;
+        }
+        QByteArray const literal = _text.mid(start, scan - start);
+
+        uuid128 const uuid = Uuid128FromBase64String(literal.constData());
+        if (uuid.isNull())
+            return;
+
+        found_site site;
+        site.uuid = uuid;
+        site.line = _line;
+        site.function = function;
+        site.isPermanent = true;
+        sites.push_back(site);
+
+        // the literal is consumed here so it isn't scanned as a string
+        _pos = scan < _text.size() ? scan + 1 : scan;
+    }
+
+private:
+    QByteArray const & _text;
+    QByteArray const _hashedFilename;
+    int _pos;
+    long _line;
+};
+
+
+struct scanned_file
+{
+    QByteArray filename;
+    std::vector<found_site> sites;
+};
+
+
+uint32_t AddString(
+    QByteArray & strings,
+    QHash<QByteArray, uint32_t> & offsets,
+    QByteArray const & str
+) {
+    auto iter = offsets.find(str);
+    if (iter != offsets.end())
+        return iter.value();
+
+    uint32_t const offset = static_cast<uint32_t>(strings.size());
+    strings.append(str);
+    strings.append('\0');
+    offsets.insert(str, offset);
+    return offset;
+}
+
+} // end anonymous namespace
+
+
+
+///
+/// Indexer
+///
+
+bool WriteCodeplaceManifest (
+    QString const & sourceRoot,
+    QString const & manifestPath,
+    QString const & filenamePrefix
+) {
+    QDir const root (sourceRoot);
+    QString const prefix = filenamePrefix.isNull()
+        ? root.absolutePath() + "/"
+        : filenamePrefix;
+
+    QStringList paths;
+    QDirIterator iter (
+        sourceRoot,
+        QStringList () << "*.cpp" << "*.cc" << "*.cxx" << "*.c"
+            << "*.h" << "*.hpp" << "*.hxx" << "*.inl",
+        QDir::Files,
+        QDirIterator::Subdirectories
+    );
+    while (iter.hasNext())
+        paths.append(iter.next());
+
+    // Files are handed out to the workers one at a time, and each result
+    // goes in its own slot so the output doesn't depend on the scheduling
+    std::vector<scanned_file> scanned (paths.size());
+    std::atomic<int> nextPath (0);
+
+    auto worker = [&]() {
+        int index;
+        while ((index = nextPath.fetch_add(1)) < paths.size()) {
+            QFile file (paths[index]);
+            if (not file.open(QIODevice::ReadOnly))
+                continue;
+            QByteArray const text = file.readAll();
+
+            scanned_file & result = scanned[index];
+            result.filename = (prefix + root.relativeFilePath(paths[index]))
+                .toUtf8();
+            result.sites = site_scanner (text, result.filename).scan();
+        }
+    };
+
+    unsigned const threadCount
+        = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (unsigned index = 1; index < threadCount; index++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread & thread : threads)
+        thread.join();
+
+    QByteArray strings;
+    QHash<QByteArray, uint32_t> stringOffsets;
+    AddString(strings, stringOffsets, QByteArray ()); // offset 0 is ""
+
+    std::vector<manifest_record> records;
+    for (scanned_file const & file : scanned) {
+        if (file.sites.empty())
+            continue;
+        uint32_t const filenameOffset
+            = AddString(strings, stringOffsets, file.filename);
+
+        for (found_site const & site : file.sites) {
+            manifest_record record;
+            record.high = site.uuid.high;
+            record.low = site.uuid.low;
+            record.filenameOffset = filenameOffset;
+            record.line = static_cast<uint32_t>(site.line);
+            record.functionOffset
+                = AddString(strings, stringOffsets, site.function);
+            record.isPermanent = site.isPermanent ? 1 : 0;
+            records.push_back(record);
+        }
+    }
+
+    std::stable_sort(
+        records.begin(),
+        records.end(),
+        [](manifest_record const & a, manifest_record const & b) {
+            return a.high != b.high ? a.high < b.high : a.low < b.low;
+        }
+    );
+
+    manifest_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, manifestMagic, sizeof(header.magic));
+    header.count = static_cast<uint32_t>(records.size());
+    header.stringsOffset = static_cast<uint32_t>(
+        sizeof(header) + records.size() * sizeof(manifest_record)
+    );
+    header.stringsSize = static_cast<uint32_t>(strings.size());
+
+    QFile out (manifestPath);
+    if (not out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    qint64 const recordBytes = static_cast<qint64>(
+        records.size() * sizeof(manifest_record)
+    );
+    return out.write(reinterpret_cast<char const *>(&header), sizeof(header))
+            == static_cast<qint64>(sizeof(header))
+        and (
+            records.empty()
+            or out.write(
+                reinterpret_cast<char const *>(records.data()), recordBytes
+            ) == recordBytes
+        )
+        and out.write(strings) == strings.size();
+}
+
+
+
+///
+/// codeplace_manifest
+///
+
+codeplace_manifest::codeplace_manifest (QString const & manifestPath) :
+    _file (manifestPath),
+    _data (nullptr),
+    _dataSize (0),
+    _count (0)
+{
+    if (not _file.open(QIODevice::ReadOnly))
+        return;
+
+    _dataSize = _file.size();
+    if (_dataSize < static_cast<qint64>(sizeof(manifest_header)))
+        return;
+
+    uchar const * data = _file.map(0, _dataSize);
+    if (not data)
+        return;
+
+    // Only the header is checked; the records are used where they lie
+    manifest_header const * header
+        = reinterpret_cast<manifest_header const *>(data);
+
+    bool const valid =
+        memcmp(header->magic, manifestMagic, sizeof(manifestMagic)) == 0
+        and header->stringsOffset == sizeof(manifest_header)
+            + static_cast<uint64_t>(header->count) * sizeof(manifest_record)
+        and static_cast<uint64_t>(header->stringsOffset) + header->stringsSize
+            <= static_cast<uint64_t>(_dataSize)
+        and header->stringsSize > 0
+        and data[header->stringsOffset + header->stringsSize - 1] == '\0';
+
+    if (not valid) {
+        _file.unmap(const_cast<uchar *>(data));
+        return;
+    }
+
+    _data = data;
+    _count = header->count;
+}
+
+
+codeplace_manifest::~codeplace_manifest () {
+    if (_data)
+        _file.unmap(const_cast<uchar *>(_data));
+}
+
+
+bool codeplace_manifest::isValid () const {
+    return _data != nullptr;
+}
+
+
+size_t codeplace_manifest::size () const {
+    return _count;
+}
+
+
+bool codeplace_manifest::lookup (uuid128 const & uuid, entry & result) const {
+    if (not _data)
+        return false;
+
+    manifest_header const * header
+        = reinterpret_cast<manifest_header const *>(_data);
+    manifest_record const * records
+        = reinterpret_cast<manifest_record const *>(_data + sizeof(*header));
+    char const * strings
+        = reinterpret_cast<char const *>(_data + header->stringsOffset);
+
+    manifest_record const * found = std::lower_bound(
+        records,
+        records + _count,
+        uuid,
+        [](manifest_record const & record, uuid128 const & key) {
+            return record.high != key.high
+                ? record.high < key.high
+                : record.low < key.low;
+        }
+    );
+
+    if (
+        found == records + _count
+        or found->high != uuid.high
+        or found->low != uuid.low
+    ) {
+        return false;
+    }
+
+    // Offsets are not trusted past the header check, so clamp them
+    uint32_t const stringsSize = header->stringsSize;
+    result.filename = strings
+        + (found->filenameOffset < stringsSize ? found->filenameOffset : 0);
+    result.line = found->line;
+    result.function = strings
+        + (found->functionOffset < stringsSize ? found->functionOffset : 0);
+    result.isPermanent = found->isPermanent != 0;
+    return true;
+}
+
+
+bool codeplace_manifest::lookup (QUuid const & uuid, entry & result) const {
+    return lookup(Uuid128FromUuid(uuid), result);
+}
+
+} // end namespace hoist
@@ -0,0 +1,159 @@
+//
+//  tracked.cpp - The table of watches set with tracked::watch().  The
+//  templates in tracked.h only come here while some watch exists.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/tracked.h"
+
+#include <QReadWriteLock>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace hoist {
+
+namespace detail {
+
+std::atomic<int> trackedWatchCount (0);
+
+} // end namespace detail
+
+
+namespace {
+
+struct watch_entry
+{
+    uint64_t id;
+    detail::tracked_watch_function notify;
+};
+
+// The watches on each object in the order they were added, and the object
+// that each watch is on so cancel() can find it
+
+struct watch_table
+{
+    std::unordered_map<void const *, std::vector<watch_entry>> byObject;
+    std::unordered_map<uint64_t, void const *> objectOf;
+};
+
+std::atomic<uint64_t> nextWatchId (1);
+
+// Function statics, so a tracked assigned during static initialization
+// can't find them unconstructed.  They are never destroyed, so neither can
+// a tracked destroyed during static destruction.
+
+QReadWriteLock & WatchLock () {
+    static QReadWriteLock & lock = *new QReadWriteLock;
+    return lock;
+}
+
+watch_table & WatchTable () {
+    static watch_table & table = *new watch_table;
+    return table;
+}
+
+} // end anonymous namespace
+
+
+uint64_t detail::AddTrackedWatch (
+    void const * object,
+    tracked_watch_function && notify
+) {
+    uint64_t const id = nextWatchId.fetch_add(1);
+
+    QWriteLocker lock (&WatchLock());
+    watch_table & table = WatchTable();
+    table.byObject[object].push_back(watch_entry {id, std::move(notify)});
+    table.objectOf.emplace(id, object);
+    trackedWatchCount.fetch_add(1);
+    return id;
+}
+
+
+// Every assignment comes here while any object is watched, so one that
+// isn't watched itself only pays for a lookup under the shared lock.  The
+// callbacks are copied out and run after the lock is released, so they are
+// free to add or cancel watches themselves.
+
+void detail::NotifyTrackedWatches (
+    void const * object,
+    void const * value,
+    codeplace const & cp
+) {
+    std::vector<tracked_watch_function> matches;
+    {
+        QReadLocker lock (&WatchLock());
+        watch_table const & table = WatchTable();
+        auto found = table.byObject.find(object);
+        if (found == table.byObject.end())
+            return;
+
+        matches.reserve(found->second.size());
+        for (watch_entry const & entry : found->second)
+            matches.push_back(entry.notify);
+    }
+
+    for (tracked_watch_function const & notify : matches)
+        notify(value, cp);
+}
+
+
+// Likewise every tracked destroyed while any object is watched, so the
+// write lock is only taken for one that has watches to remove
+
+void detail::ForgetTrackedWatches (void const * object) {
+    {
+        QReadLocker lock (&WatchLock());
+        watch_table const & table = WatchTable();
+        if (table.byObject.find(object) == table.byObject.end())
+            return;
+    }
+
+    QWriteLocker lock (&WatchLock());
+    watch_table & table = WatchTable();
+    auto found = table.byObject.find(object);
+    if (found == table.byObject.end())
+        return;
+
+    for (watch_entry const & entry : found->second)
+        table.objectOf.erase(entry.id);
+    trackedWatchCount.fetch_sub(static_cast<int>(found->second.size()));
+    table.byObject.erase(found);
+}
+
+
+void tracked_watch::cancel () {
+    if (_id == 0)
+        return;
+
+    QWriteLocker lock (&WatchLock());
+    watch_table & table = WatchTable();
+
+    // Gone already if the object was destroyed before the watch was
+    auto object = table.objectOf.find(_id);
+    if (object != table.objectOf.end()) {
+        auto found = table.byObject.find(object->second);
+        std::vector<watch_entry> & entries = found->second;
+        uint64_t const id = _id;
+        entries.erase(std::find_if(
+            entries.begin(),
+            entries.end(),
+            [id](watch_entry const & entry) { return entry.id == id; }
+        ));
+        if (entries.empty())
+            table.byObject.erase(found);
+        table.objectOf.erase(object);
+        detail::trackedWatchCount.fetch_sub(1);
+    }
+    _id = 0;
+}
+
+} // end namespace hoist
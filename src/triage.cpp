@@ -0,0 +1,425 @@
+//
+//  triage.cpp - Memory-mapped triage database, and the hope failed handler
+//  which consults it.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/triage.h"
+#include "hoist/hopefully.h"
+
+#include <QDateTime>
+#include <QDebug>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace hoist {
+
+static_assert(
+    ATOMIC_INT_LOCK_FREE == 2 and ATOMIC_LLONG_LOCK_FREE == 2,
+    "triage records are updated with atomics in a file mapping"
+);
+
+
+///
+/// File layout
+///
+
+namespace {
+
+char const triageMagic[8] = {'H', 'O', 'I', 'S', 'T', 'T', 'R', '1'};
+
+struct triage_header
+{
+    char magic[8];
+    uint32_t capacity;
+    uint32_t recordSize;
+    char reserved[112];
+};
+
+// state of a record
+uint32_t const triageEmpty = 0;
+uint32_t const triageClaiming = 1;
+uint32_t const triageReady = 2;
+uint32_t const triageAbandoned = 3; // claim interrupted by a crash
+
+size_t const triageMessageSize = 72;
+
+} // end anonymous namespace
+
+
+// One cache line pair per site.  The message is guarded by a sequence
+// number: odd while a writer is in it, so readers know to try again.
+
+struct triage_database::record_type final
+{
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> disposition;
+    uint64_t high;
+    uint64_t low;
+    std::atomic<uint64_t> count;
+    std::atomic<int64_t> firstSeenMsecs;
+    std::atomic<int64_t> lastSeenMsecs;
+    std::atomic<uint32_t> messageSequence;
+    uint32_t messageLength;
+    char message[triageMessageSize];
+};
+
+static_assert(
+    sizeof(triage_header) == 128,
+    "records follow the header on a 128 byte boundary"
+);
+
+
+
+///
+/// triage_database
+///
+
+triage_database::triage_database (
+    QString const & path,
+    triage_disposition defaultDisposition,
+    size_t capacity
+) :
+    _file (path),
+    _data (nullptr),
+    _capacity (0),
+    _defaultDisposition (
+        defaultDisposition == triage_disposition::Default
+            ? triage_disposition::Fatal
+            : defaultDisposition
+    )
+{
+    static_assert(
+        sizeof(record_type) == 128, "triage records are 128 bytes"
+    );
+
+    if (not _file.open(QIODevice::ReadWrite))
+        return;
+
+    triage_header header;
+    if (_file.size() == 0) {
+        size_t rounded = 16;
+        while (rounded < capacity)
+            rounded *= 2;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, triageMagic, sizeof(header.magic));
+        header.capacity = static_cast<uint32_t>(rounded);
+        header.recordSize = sizeof(record_type);
+
+        // resize() fills with zeros, which is an empty record
+        if (
+            not _file.resize(sizeof(header) + rounded * sizeof(record_type))
+            or _file.write(
+                reinterpret_cast<char const *>(&header), sizeof(header)
+            ) != static_cast<qint64>(sizeof(header))
+            or not _file.flush()
+        ) {
+            return;
+        }
+    } else {
+        if (
+            _file.read(reinterpret_cast<char *>(&header), sizeof(header))
+            != static_cast<qint64>(sizeof(header))
+        ) {
+            return;
+        }
+    }
+
+    bool const valid =
+        memcmp(header.magic, triageMagic, sizeof(triageMagic)) == 0
+        and header.recordSize == sizeof(record_type)
+        and header.capacity != 0
+        and (header.capacity & (header.capacity - 1)) == 0
+        and _file.size() >= static_cast<qint64>(
+            sizeof(header) + header.capacity * sizeof(record_type)
+        );
+    if (not valid)
+        return;
+
+    _data = _file.map(
+        0, sizeof(header) + header.capacity * sizeof(record_type)
+    );
+    if (not _data)
+        return;
+    _capacity = header.capacity;
+
+    // Repair what a crash in the middle of an update could have left.  This
+    // assumes no other process has the file open while it's being opened.
+    record_type * records
+        = reinterpret_cast<record_type *>(_data + sizeof(triage_header));
+    for (size_t index = 0; index < _capacity; index++) {
+        record_type & rec = records[index];
+        if (rec.state.load() == triageClaiming)
+            rec.state.store(triageAbandoned);
+
+        uint32_t const sequence = rec.messageSequence.load();
+        if (sequence % 2 != 0) {
+            rec.messageLength = 0;
+            rec.messageSequence.store(sequence + 1);
+        }
+    }
+}
+
+
+triage_database::~triage_database () {
+    if (_data)
+        _file.unmap(_data);
+}
+
+
+bool triage_database::isValid () const {
+    return _data != nullptr;
+}
+
+
+size_t triage_database::capacity () const {
+    return _capacity;
+}
+
+
+// Open addressing with linear probing.  Records are never removed, so an
+// empty record ends the search.  A claim is made with a compare-and-swap on
+// the state, and the key is written before the state says it's ready.
+
+triage_database::record_type * triage_database::find (
+    uuid128 const & uuid,
+    bool const create
+) const {
+    if (not _data or uuid.isNull())
+        return nullptr;
+
+    record_type * records
+        = reinterpret_cast<record_type *>(_data + sizeof(triage_header));
+    size_t const mask = _capacity - 1;
+    size_t const start = static_cast<size_t>(uuid.high ^ uuid.low);
+
+    for (size_t probe = 0; probe < _capacity; probe++) {
+        record_type & rec = records[(start + probe) & mask];
+
+        uint32_t state = rec.state.load(std::memory_order_acquire);
+        if (state == triageEmpty) {
+            if (not create)
+                return nullptr;
+
+            if (
+                rec.state.compare_exchange_strong(
+                    state, triageClaiming, std::memory_order_acq_rel
+                )
+            ) {
+                rec.high = uuid.high;
+                rec.low = uuid.low;
+                rec.state.store(triageReady, std::memory_order_release);
+                return &rec;
+            }
+            // lost the race, state now says what the winner is doing
+        }
+
+        while (state == triageClaiming) {
+            std::this_thread::yield();
+            state = rec.state.load(std::memory_order_acquire);
+        }
+
+        if (
+            state == triageReady
+            and rec.high == uuid.high
+            and rec.low == uuid.low
+        ) {
+            return &rec;
+        }
+    }
+    return nullptr;
+}
+
+
+triage_disposition triage_database::record (
+    codeplace const & cp,
+    QString const & message,
+    uint64_t occurrences
+) {
+    record_type * rec = find(cp.getUuid128(), true);
+    if (not rec)
+        return _defaultDisposition;
+
+    int64_t const now = QDateTime::currentMSecsSinceEpoch();
+    if (rec->count.fetch_add(occurrences) == 0)
+        rec->firstSeenMsecs.store(now);
+    rec->lastSeenMsecs.store(now);
+
+    triage_disposition const result = static_cast<triage_disposition>(
+        rec->disposition.load(std::memory_order_relaxed)
+    );
+    triage_disposition const resolved = result == triage_disposition::Default
+        ? _defaultDisposition
+        : result;
+
+    if (resolved == triage_disposition::Ignore)
+        return resolved;
+
+    // If another thread is writing the message, let its message stand
+    uint32_t sequence = rec->messageSequence.load();
+    if (
+        sequence % 2 == 0
+        and rec->messageSequence.compare_exchange_strong(
+            sequence, sequence + 1
+        )
+    ) {
+        QByteArray const utf8 = message.toUtf8();
+        size_t const length = std::min(
+            static_cast<size_t>(utf8.size()), triageMessageSize
+        );
+        memcpy(rec->message, utf8.constData(), length);
+        rec->messageLength = static_cast<uint32_t>(length);
+        rec->messageSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    return resolved;
+}
+
+
+triage_disposition triage_database::disposition (uuid128 const & uuid) const {
+    record_type const * rec = find(uuid, false);
+    triage_disposition const result = rec
+        ? static_cast<triage_disposition>(rec->disposition.load())
+        : triage_disposition::Default;
+    return result == triage_disposition::Default
+        ? _defaultDisposition
+        : result;
+}
+
+
+bool triage_database::setDisposition (
+    uuid128 const & uuid,
+    triage_disposition const & disposition
+) {
+    record_type * rec = find(uuid, true);
+    if (not rec)
+        return false;
+    rec->disposition.store(static_cast<uint32_t>(disposition));
+    return true;
+}
+
+
+bool triage_database::lookup (uuid128 const & uuid, entry & result) const {
+    record_type const * rec = find(uuid, false);
+    if (not rec)
+        return false;
+
+    result.uuid = uuid;
+    result.count = rec->count.load();
+    result.firstSeenMsecs = rec->firstSeenMsecs.load();
+    result.lastSeenMsecs = rec->lastSeenMsecs.load();
+    result.disposition
+        = static_cast<triage_disposition>(rec->disposition.load());
+
+    char message[triageMessageSize];
+    uint32_t length;
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = rec->messageSequence.load(std::memory_order_acquire);
+        length = std::min(
+            rec->messageLength, static_cast<uint32_t>(triageMessageSize)
+        );
+        memcpy(message, rec->message, length);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = rec->messageSequence.load(std::memory_order_relaxed);
+    } while (before % 2 != 0 or before != after);
+
+    result.lastMessage
+        = QString::fromUtf8(message, static_cast<int>(length));
+    return true;
+}
+
+
+
+///
+/// Handler
+///
+
+namespace {
+
+std::atomic<triage_database *> globalTriageDatabase (nullptr);
+
+// How much of each site's hopeFailedCount() has gone into the database is
+// kept in the site's counters, in the low 48 bits of triageRecorded.  The
+// high 16 bits say which database it was for, so setting a new database
+// starts every site over from 0 without visiting them.
+uint64_t const triageCountMask = (uint64_t (1) << 48) - 1;
+std::atomic<uint64_t> triageGeneration (0);
+
+
+// A site that doesn't keep counters (like a YONDER) reaches here once per
+// failure.  Otherwise this can be 0, when the delivery thread is behind
+// and an earlier call already counted the failure being delivered.  The
+// recorded count only goes up, so two failing threads that read their
+// totals in one order and get here in the other don't count twice.
+uint64_t UnrecordedFailures(codeplace const & cp) {
+    codeplace::site_counters * counters = codeplace::counters(codesite (cp));
+    if (not counters)
+        return 1;
+    uint64_t const total = counters->failures.load() & triageCountMask;
+    uint64_t const generation = triageGeneration.load() << 48;
+
+    uint64_t packed = counters->triageRecorded.load();
+    while (true) {
+        uint64_t const recorded = (packed & ~triageCountMask) == generation
+            ? packed & triageCountMask
+            : 0;
+        if (total <= recorded)
+            return 0;
+        if (
+            counters->triageRecorded.compare_exchange_weak(
+                packed, generation | total
+            )
+        ) {
+            return total - recorded;
+        }
+    }
+}
+
+} // end anonymous namespace
+
+
+void setHopeFailedTriageDatabase (triage_database * database) {
+    triageGeneration.store((triageGeneration.load() + 1) & 0xFFFF);
+    globalTriageDatabase.store(database);
+}
+
+
+void onHopeFailedTriage (QString const & message, codeplace const & cp) {
+    triage_database * database = globalTriageDatabase.load();
+    if (not database or not database->isValid() or cp.isNull()) {
+        onHopeFailedBasic(message, cp);
+        return;
+    }
+
+    switch (database->record(cp, message, UnrecordedFailures(cp))) {
+    case triage_disposition::Ignore:
+        break;
+
+    case triage_disposition::Log: {
+        char where[codeplace::FormatBufferSize];
+        cp.format(where);
+        qDebug() << message << endl
+            << "     output from: " << where << endl;
+        break;
+    }
+
+    case triage_disposition::Default:
+    case triage_disposition::Fatal:
+        onHopeFailedBasic(message, cp);
+        break;
+    }
+}
+
+} // end namespace hoist
@@ -0,0 +1,166 @@
+//
+//  uuid128.cpp - Fixed-width base64 encoding and decoding of uuid128
+//  values, working on caller-provided buffers so that no QByteArray or
+//  QDataStream is involved.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/uuid128.h"
+
+namespace hoist {
+
+namespace {
+
+char const base64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 0xFF for anything that is not in the alphabet, so OR-ing together all the
+// lookups for an id tells whether any character was bad without a branch
+uint8_t const base64Sextets[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B,
+    0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+    0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20,
+    0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30,
+    0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+
+inline void EncodeOne(uuid128 const & uuid, char * chars) {
+    uint64_t const high = uuid.high;
+    uint64_t const low = uuid.low;
+
+    for (int index = 0; index < 10; index++)
+        chars[index] = base64Alphabet[(high >> (58 - 6 * index)) & 0x3F];
+
+    chars[10] = base64Alphabet[((high & 0xF) << 2) | (low >> 62)];
+
+    for (int index = 11; index < 21; index++)
+        chars[index] = base64Alphabet[(low >> (122 - 6 * index)) & 0x3F];
+
+    chars[21] = base64Alphabet[(low & 0x3) << 4];
+}
+
+
+// Returns the OR of the sextets, which has the high bit set if any of the
+// characters were not base64
+inline uint8_t DecodeOne(char const * chars, uuid128 & uuid) {
+    uint8_t sextets[22];
+    uint8_t bad = 0;
+    for (int index = 0; index < 22; index++) {
+        sextets[index] = base64Sextets[static_cast<uint8_t>(chars[index])];
+        bad |= sextets[index];
+    }
+
+    uint64_t high = 0;
+    for (int index = 0; index < 10; index++)
+        high |= static_cast<uint64_t>(sextets[index]) << (58 - 6 * index);
+    high |= static_cast<uint64_t>(sextets[10] >> 2);
+
+    uint64_t low = static_cast<uint64_t>(sextets[10] & 0x3) << 62;
+    for (int index = 11; index < 21; index++)
+        low |= static_cast<uint64_t>(sextets[index]) << (122 - 6 * index);
+    low |= static_cast<uint64_t>(sextets[21] >> 4);
+
+    uuid = uuid128 (high, low);
+    return bad;
+}
+
+} // end anonymous namespace
+
+
+void Base64CharsFromUuid128 (
+    uuid128 const & uuid,
+    char (& chars)[Base64UuidLength]
+) {
+    EncodeOne(uuid, chars);
+}
+
+
+bool Uuid128FromBase64Chars (
+    char const (& chars)[Base64UuidLength],
+    uuid128 & uuid
+) {
+    if (DecodeOne(chars, uuid) & 0x80) {
+        uuid = uuid128 ();
+        return false;
+    }
+    return true;
+}
+
+
+void Base64CharsFromUuid128s (
+    uuid128 const * uuids,
+    size_t const count,
+    char * chars
+) {
+    for (size_t index = 0; index < count; index++)
+        EncodeOne(uuids[index], chars + index * Base64UuidLength);
+}
+
+
+size_t Uuid128sFromBase64Chars (
+    char const * chars,
+    size_t const count,
+    uuid128 * uuids
+) {
+    size_t bad = 0;
+    for (size_t index = 0; index < count; index++) {
+        if (DecodeOne(chars + index * Base64UuidLength, uuids[index]) & 0x80) {
+            uuids[index] = uuid128 ();
+            bad++;
+        }
+    }
+    return bad;
+}
+
+
+// Reads up to the first 22 characters; stopping at a terminator (or any
+// other bad character) gives a null uuid128
+
+uuid128 Uuid128FromBase64String (char const * str) {
+    char chars[Base64UuidLength];
+    for (size_t index = 0; index < Base64UuidLength; index++) {
+        if (str[index] == '\0')
+            return uuid128 ();
+        chars[index] = str[index];
+    }
+
+    uuid128 uuid;
+    Uuid128FromBase64Chars(chars, uuid);
+    return uuid;
+}
+
+} // end namespace hoist
@@ -0,0 +1,80 @@
+//
+// codeplace_test.cpp - Tests of codeplace copying, moving and equality.
+//  Each check that fails is printed with its line, and the exit code is
+//  the number of failures.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/codeplace.h"
+
+#include <cstdio>
+#include <functional>
+#include <utility>
+
+using namespace hoist;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (not (condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, \
+                #condition); \
+            failures++; \
+        } \
+    } while (false)
+
+
+bool LooksNull (codeplace const & cp) {
+    return cp.isNull()
+        and cp == codeplace ()
+        and std::hash<codeplace>()(cp) == 0;
+}
+
+
+// Whatever way a codeplace becomes null, it keeps nothing of the site it
+// held, so it doesn't compare or hash like that site any more
+
+void TestBecomingNull () {
+    codeplace const site = HERE;
+    CHECK(not LooksNull(site));
+
+    codeplace moved (site);
+    codeplace taker (std::move(moved));
+    CHECK(taker == site);
+    CHECK(LooksNull(moved));
+
+    codeplace assigned (site);
+    codeplace other = HERE;
+    other = std::move(assigned);
+    CHECK(other == site);
+    CHECK(LooksNull(assigned));
+
+    codeplace overwritten (site);
+    overwritten = codeplace ();
+    CHECK(LooksNull(overwritten));
+
+    codeplace copied (site);
+    codeplace const null;
+    copied = null;
+    CHECK(LooksNull(copied));
+}
+
+} // end anonymous namespace
+
+
+int main () {
+    TestBecomingNull();
+
+    if (failures == 0)
+        printf("codeplace_test: all passed\n");
+    return failures;
+}
@@ -0,0 +1,106 @@
+//
+// snapshot_test.cpp - Tests of the snapshots that listed and mapped hand
+//  out.  Each check that fails is printed with its line, and the exit code
+//  is the number of failures.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/snapshot.h"
+#include "hoist/listed.h"
+#include "hoist/mapped.h"
+
+#include <cstdio>
+
+using namespace hoist;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (not (condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, \
+                #condition); \
+            failures++; \
+        } \
+    } while (false)
+
+
+// A snapshot that was taken stays as it was while instances come and go
+
+void TestListed () {
+    listed<int>::manager manager;
+    listed<int> first (1, manager, HERE);
+
+    listed<int>::manager::snapshot_type before = manager.getSnapshot();
+    {
+        listed<int> second (2, manager, HERE);
+        listed<int> third (3, manager, HERE);
+
+        QList<tracked<int>> list = manager.getList();
+        CHECK(list.size() == 3);
+        CHECK(list[0].get() == 1 and list[1].get() == 2 and list[2].get() == 3);
+    }
+
+    CHECK(before.size() == 1);
+    CHECK(manager.getSnapshot().size() == 1);
+    CHECK(manager.getList()[0].get() == 1);
+
+    // Every snapshot shares the one copy that the instance keeps
+    CHECK(&*before.begin() == &*manager.getSnapshot().begin());
+}
+
+
+// Lookups see assignments, and a snapshot keeps the value it was taken with
+
+void TestMapped () {
+    mapped<int, int>::manager manager;
+    mapped<int, int> item (7, 70, manager, HERE);
+
+    CHECK(manager.lookupValue(7, -1) == 70);
+    CHECK(manager.lookupValue(8, -1) == -1);
+
+    mapped<int, int>::manager::snapshot_type before = manager.getSnapshot();
+    item.assign(71, HERE);
+
+    CHECK(manager.lookupValue(7, -1) == 71);
+    CHECK(manager.lookupHopefully(7, HERE).get() == 71);
+    CHECK(before.find(7)->get() == 70);
+    CHECK(manager.getSnapshot().find(7)->get() == 71);
+    CHECK(not manager.getSnapshot().contains(8));
+
+    QMap<int, tracked<int>> map = manager.getMap();
+    CHECK(map.size() == 1 and map.contains(7));
+
+    // Snapshots are in key order, whatever order the items came in
+    mapped<int, int> later (9, 90, manager, HERE);
+    mapped<int, int> earlier (3, 30, manager, HERE);
+    mapped<int, int>::manager::snapshot_type after = manager.getSnapshot();
+    int previousKey = 0;
+    for (auto iter = after.begin(); iter != after.end(); ++iter) {
+        CHECK(iter.key() > previousKey);
+        CHECK(iter.value().get() == iter.key() * 10 + (iter.key() == 7));
+        previousKey = iter.key();
+    }
+    CHECK(after.size() == 3 and after.find(3)->get() == 30);
+    CHECK(not after.contains(5) and not after.contains(10));
+}
+
+} // end anonymous namespace
+
+
+int main () {
+    TestListed();
+    TestMapped();
+
+    if (failures == 0)
+        printf("snapshot_test: all passed\n");
+    return failures;
+}
@@ -0,0 +1,165 @@
+//
+// tracked_test.cpp - Tests of tracked assignment, history, watches and sets.
+//  Each check that fails is printed with its line, and the exit code is
+//  the number of failures.
+//
+//          Copyright (c) 2009-2014 HostileFork.com
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//           http://www.boost.org/LICENSE_1_0.txt)
+//
+// See http://hostilefork.com/hoist/ for documentation.
+//
+
+#include "hoist/tracked.h"
+#include "hoist/hopefully.h"
+
+#include <cstdio>
+
+using namespace hoist;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (not (condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s)\n", __FILE__, __LINE__, \
+                #condition); \
+            failures++; \
+        } \
+    } while (false)
+
+
+// The value being assigned is the value already there
+
+void TestSelfAssign () {
+    tracked<QString> name (QString ("first"), HERE);
+
+    name.assign(name.get(), HERE);
+    CHECK(name.get() == QString ("first"));
+
+    tracked<QString, codeplace, 3> history (QString ("first"), HERE);
+
+    history.assign(history.get(), HERE);
+    CHECK(history.get() == QString ("first"));
+    CHECK(history.historySize() == 2);
+    CHECK(history.valueAtAge(1) == QString ("first"));
+}
+
+
+// The value being assigned is in the history, in the slot that the push
+// of the current value reuses or in one it leaves alone
+
+void TestHistoryAssign () {
+    tracked<QString, codeplace, 3> value (QString ("a"), HERE);
+    value.assign(QString ("b"), HERE);
+    value.assign(QString ("c"), HERE);
+    CHECK(value.historySize() == 3);
+
+    // the oldest, whose slot gets the current value
+    value.assign(value.valueAtAge(2), HERE);
+    CHECK(value.get() == QString ("a"));
+    CHECK(value.valueAtAge(1) == QString ("c"));
+    CHECK(value.valueAtAge(2) == QString ("b"));
+
+    value.assign(value.valueAtAge(1), HERE);
+    CHECK(value.get() == QString ("c"));
+    CHECK(value.valueAtAge(1) == QString ("a"));
+    CHECK(value.valueAtAge(2) == QString ("c"));
+}
+
+
+// Without a history only age 0 can be asked for
+
+void TestNoHistory () {
+    tracked<QString> value (QString ("a"), HERE);
+    value.assign(QString ("b"), HERE);
+
+    CHECK(value.historySize() == 1);
+    CHECK(value.valueAtAge(0) == QString ("b"));
+    CHECK(value.whereAssignedAtAge(0) == value.whereLastAssigned());
+    CHECK(value.whenAssignedAtAge(0) == 0);
+}
+
+
+// Watches are found by the address of what they watch, and go away with it
+
+void TestWatches () {
+    tracked<int> watched (0, HERE);
+    tracked<int> other (0, HERE);
+    int fired = 0;
+
+    tracked_watch watch = watched.watchFor(
+        2, [&](int const &, codeplace const &) { fired++; }
+    );
+    other.assign(2, HERE);
+    watched.assign(1, HERE);
+    watched.assign(2, HERE);
+    CHECK(fired == 1);
+
+    tracked_watch orphan;
+    {
+        tracked<int> dying (0, HERE);
+        orphan = dying.watch(
+            [](int const &) { return true; },
+            [&](int const &, codeplace const &) { fired++; }
+        );
+    }
+    CHECK(detail::trackedWatchCount.load() == 1);
+    orphan.cancel();
+
+    watch.cancel();
+    watched.assign(2, HERE);
+    CHECK(fired == 1);
+    CHECK(detail::trackedWatchCount.load() == 0);
+}
+
+
+codeplace lastFailedAt;
+
+void RememberFailure (QString const &, codeplace const & cp) {
+    lastFailedAt = cp;
+}
+
+
+// Sets end with a codeplace or a codesite, and constants that span more
+// than 64 values are compared one at a time
+
+void TestSets () {
+    setHopeFailedHandler(&RememberFailure);
+
+    tracked<int> value (5, HERE);
+    codesite const site (HERE);
+
+    CHECK(value.hopefullyInSet(1, 5, HERE));
+    CHECK(value.hopefullyInSet(1, 5, site));
+    CHECK(value.hopefullyNotInSet(1, 2, site));
+
+    CHECK(not value.hopefullyInSet(1, 2, site));
+    CHECK(lastFailedAt == codeplace (site));
+    CHECK(not value.hopefullyNotInSet(5, site));
+
+    CHECK((value.hopefullyInSetOf<5, 1000>(HERE)));
+    CHECK((value.hopefullyNotInSetOf<4, 1000>(HERE)));
+    value.assign(1000, HERE);
+    CHECK((value.hopefullyInSetOf<5, 1000>(HERE)));
+
+    setHopeFailedHandler(nullptr);
+}
+
+} // end anonymous namespace
+
+
+int main () {
+    TestSelfAssign();
+    TestHistoryAssign();
+    TestNoHistory();
+    TestWatches();
+    TestSets();
+
+    if (failures == 0)
+        printf("tracked_test: all passed\n");
+    return failures;
+}